@@ -0,0 +1,93 @@
+#include "alloc.h"
+
+static const char *alloc_site_to_cstr_map[ALLOC_SITES_COUNT] = {
+	[ALLOC_PARSER_INPUT] = "parser input",
+	[ALLOC_LITERAL]      = "literals",
+	[ALLOC_PROGRAM]      = "program",
+	[ALLOC_STACK]        = "stack",
+	[ALLOC_ARENA]        = "arena",
+	[ALLOC_SOURCE]       = "sources",
+	[ALLOC_PROFILE]      = "profile",
+};
+
+const char *alloc_site_to_cstr(alloc_site_t site) {
+	assert(site < ALLOC_SITES_COUNT && site >= 0);
+	return alloc_site_to_cstr_map[site];
+}
+
+/* Every allocation is prefixed with its size, so frees can be accounted for too */
+typedef union {
+	size_t      size;
+	long double align;
+} alloc_header_t;
+
+/* Allocations can happen on several threads at once (spawn workers, the streaming parser) */
+static alloc_stats_t stats;
+
+static void alloc_account(alloc_site_t site, size_t size) {
+	__atomic_add_fetch(&stats.count[site], 1,    __ATOMIC_RELAXED);
+	__atomic_add_fetch(&stats.bytes[site], size, __ATOMIC_RELAXED);
+
+	size_t live = __atomic_add_fetch(&stats.live, size, __ATOMIC_RELAXED);
+	size_t peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+	while (live > peak &&
+	       !__atomic_compare_exchange_n(&stats.peak, &peak, live, true,
+	                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+void *alloc_malloc(alloc_site_t site, size_t size) {
+	alloc_header_t *header = (alloc_header_t*)malloc(sizeof(alloc_header_t) + size);
+	if (header == NULL)
+		return NULL;
+
+	header->size = size;
+	alloc_account(site, size);
+	return header + 1;
+}
+
+void *alloc_realloc(alloc_site_t site, void *ptr, size_t size) {
+	if (ptr == NULL)
+		return alloc_malloc(site, size);
+
+	alloc_header_t *header = (alloc_header_t*)ptr - 1;
+	size_t          old    = header->size;
+
+	header = (alloc_header_t*)realloc(header, sizeof(alloc_header_t) + size);
+	if (header == NULL)
+		return NULL;
+
+	header->size = size;
+	__atomic_sub_fetch(&stats.live, old, __ATOMIC_RELAXED);
+	alloc_account(site, size);
+	return header + 1;
+}
+
+void alloc_free(void *ptr) {
+	if (ptr == NULL)
+		return;
+
+	alloc_header_t *header = (alloc_header_t*)ptr - 1;
+	__atomic_sub_fetch(&stats.live, header->size, __ATOMIC_RELAXED);
+	free(header);
+}
+
+alloc_stats_t alloc_stats(void) {
+	alloc_stats_t copy;
+	for (size_t i = 0; i < ALLOC_SITES_COUNT; ++ i) {
+		copy.count[i] = __atomic_load_n(&stats.count[i], __ATOMIC_RELAXED);
+		copy.bytes[i] = __atomic_load_n(&stats.bytes[i], __ATOMIC_RELAXED);
+	}
+
+	copy.live = __atomic_load_n(&stats.live, __ATOMIC_RELAXED);
+	copy.peak = __atomic_load_n(&stats.peak, __ATOMIC_RELAXED);
+	return copy;
+}
+
+void alloc_stats_fprintf(alloc_stats_t *stats, FILE *file) {
+	fprintf(file, "%-14s %12s %14s\n", "Allocations", "Count", "Bytes");
+	for (size_t i = 0; i < ALLOC_SITES_COUNT; ++ i)
+		fprintf(file, "  %-12s %12zu %14zu\n", alloc_site_to_cstr((alloc_site_t)i),
+		        stats->count[i], stats->bytes[i]);
+
+	fprintf(file, "Peak live heap: %zu bytes\n", stats->peak);
+}
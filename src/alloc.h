@@ -0,0 +1,39 @@
+#ifndef ALLOC_H_HEADER_GUARD
+#define ALLOC_H_HEADER_GUARD
+
+#include <stdio.h>   /* fprintf */
+#include <stdlib.h>  /* malloc, realloc, free, size_t */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+/* Places that allocate often enough to be worth accounting for */
+typedef enum {
+	ALLOC_PARSER_INPUT = 0,
+	ALLOC_LITERAL,
+	ALLOC_PROGRAM,
+	ALLOC_STACK,
+	ALLOC_ARENA,
+	ALLOC_SOURCE,
+	ALLOC_PROFILE,
+
+	ALLOC_SITES_COUNT,
+} alloc_site_t;
+
+const char *alloc_site_to_cstr(alloc_site_t site);
+
+/* Thin wrapper over malloc that counts allocations and bytes per site and tracks the peak of the
+   live bytes. Memory from these has to be freed with alloc_free */
+void *alloc_malloc (alloc_site_t site, size_t size);
+void *alloc_realloc(alloc_site_t site, void *ptr, size_t size);
+void  alloc_free   (void *ptr);
+
+typedef struct {
+	size_t count[ALLOC_SITES_COUNT];
+	size_t bytes[ALLOC_SITES_COUNT];
+	size_t live, peak;
+} alloc_stats_t;
+
+alloc_stats_t alloc_stats(void);
+void          alloc_stats_fprintf(alloc_stats_t *stats, FILE *file);
+
+#endif
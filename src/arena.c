@@ -0,0 +1,75 @@
+#include "arena.h"
+
+#define ARENA_ALIGN(SIZE) (((SIZE) + 7) & ~(size_t)7)
+
+arena_t arena_new(void) {
+	return (arena_t){0};
+}
+
+void arena_destroy(arena_t *arena) {
+	assert(arena != NULL);
+
+	arena_chunk_t *next;
+	for (arena_chunk_t *chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		alloc_free(chunk);
+	}
+
+	arena->chunks = NULL;
+	arena->size   = 0;
+}
+
+void arena_reset(arena_t *arena) {
+	assert(arena != NULL);
+	if (arena->chunks == NULL)
+		return;
+
+	/* Keep the newest chunk around, so a program that keeps allocating and dropping values does
+	   not go to the allocator every reset */
+	arena_chunk_t *keep = arena->chunks;
+	arena->chunks = keep->next;
+	arena_destroy(arena);
+
+	keep->next    = NULL;
+	keep->size    = 0;
+	arena->chunks = keep;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+	assert(arena != NULL);
+
+	size = ARENA_ALIGN(size);
+	arena_chunk_t *chunk = arena->chunks;
+	if (chunk == NULL || chunk->size + size > chunk->cap) {
+		size_t cap = size > ARENA_CHUNK_CAP? size : ARENA_CHUNK_CAP;
+		chunk = (arena_chunk_t*)alloc_malloc(ALLOC_ARENA, sizeof(arena_chunk_t) + cap);
+		assert(chunk != NULL);
+
+		chunk->cap    = cap;
+		chunk->size   = 0;
+		chunk->next   = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	void *ptr = chunk->buf + chunk->size;
+	chunk->size += size;
+	arena->size += size;
+	return ptr;
+}
+
+bool arena_extend(arena_t *arena, void *ptr, size_t size, size_t new_size) {
+	assert(arena != NULL);
+
+	/* Only the last allocation can grow in place */
+	arena_chunk_t *chunk = arena->chunks;
+	size     = ARENA_ALIGN(size);
+	new_size = ARENA_ALIGN(new_size);
+	if (chunk == NULL || (char*)ptr + size != chunk->buf + chunk->size)
+		return false;
+	else if (chunk->size - size + new_size > chunk->cap)
+		return false;
+
+	chunk->size += new_size - size;
+	arena->size += new_size - size;
+	return true;
+}
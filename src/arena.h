@@ -0,0 +1,33 @@
+#ifndef ARENA_H_HEADER_GUARD
+#define ARENA_H_HEADER_GUARD
+
+#include <stdlib.h>  /* size_t */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "alloc.h"
+
+#define ARENA_CHUNK_CAP (64 * 1024)
+
+typedef struct arena_chunk arena_chunk_t;
+struct arena_chunk {
+	arena_chunk_t *next;
+	size_t         cap, size;
+
+	char buf[];
+};
+
+/* Bump allocator, everything allocated from it is freed at once by arena_reset */
+typedef struct {
+	arena_chunk_t *chunks;
+	size_t         size;
+} arena_t;
+
+arena_t arena_new    (void);
+void    arena_destroy(arena_t *arena);
+void    arena_reset  (arena_t *arena);
+
+void *arena_alloc (arena_t *arena, size_t size);
+bool  arena_extend(arena_t *arena, void *ptr, size_t size, size_t new_size);
+
+#endif
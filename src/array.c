@@ -0,0 +1,250 @@
+#include "array.h"
+
+/* The kernels have an AVX2 version picked at runtime when the CPU supports it, everything else
+   goes through the scalar loops which the compiler can still vectorize with SSE2 */
+#if defined(__GNUC__) && defined(__x86_64__)
+#	define ARRAY_AVX2
+#	include <immintrin.h>
+#endif
+
+array_t *array_new(arena_t *arena, size_t size) {
+	array_t *arr = (array_t*)arena_alloc(arena, sizeof(array_t) + size * sizeof(int64_t));
+	arr->size = size;
+	return arr;
+}
+
+array_t *array_copy(arena_t *arena, const array_t *arr) {
+	array_t *copy = array_new(arena, arr->size);
+	memcpy(copy->buf, arr->buf, arr->size * sizeof(int64_t));
+	return copy;
+}
+
+/* Arithmetic wraps around, like the vector instructions do */
+static int64_t array_apply(array_op_t op, int64_t a, int64_t b) {
+	switch (op) {
+	case ARRAY_ADD: return (int64_t)((uint64_t)a + (uint64_t)b);
+	case ARRAY_SUB: return (int64_t)((uint64_t)a - (uint64_t)b);
+	case ARRAY_MUL: return (int64_t)((uint64_t)a * (uint64_t)b);
+
+	default: assert(0);
+	}
+
+	return 0;
+}
+
+#ifdef ARRAY_AVX2
+static bool array_has_avx2(void) {
+	static int has = -1;
+	if (has == -1)
+		has = __builtin_cpu_supports("avx2")? 1 : 0;
+
+	return has;
+}
+
+__attribute__((target("avx2")))
+static __m256i array_mul_avx2(__m256i a, __m256i b) {
+	/* There is no 64 bit multiply in AVX2, build it from 32 bit ones */
+	__m256i lo    = _mm256_mul_epu32(a, b);
+	__m256i cross = _mm256_add_epi64(_mm256_mul_epu32(_mm256_srli_epi64(a, 32), b),
+	                                 _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32)));
+	return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+__attribute__((target("avx2")))
+static __m256i array_apply_avx2(array_op_t op, __m256i a, __m256i b) {
+	switch (op) {
+	case ARRAY_ADD: return _mm256_add_epi64(a, b);
+	case ARRAY_SUB: return _mm256_sub_epi64(a, b);
+	case ARRAY_MUL: return array_mul_avx2(a, b);
+
+	default: assert(0);
+	}
+
+	return a;
+}
+
+__attribute__((target("avx2")))
+static size_t array_op_avx2(array_op_t op, int64_t *out, const int64_t *a, const int64_t *b,
+                            size_t size) {
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i vb = _mm256_loadu_si256((const __m256i*)(b + i));
+		_mm256_storeu_si256((__m256i*)(out + i), array_apply_avx2(op, va, vb));
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t array_op_scalar_avx2(array_op_t op, int64_t *out, const int64_t *a, int64_t b,
+                                   size_t size, bool scalar_first) {
+	__m256i vb = _mm256_set1_epi64x(b);
+	size_t  i  = 0;
+	for (; i + 4 <= size; i += 4) {
+		__m256i va = _mm256_loadu_si256((const __m256i*)(a + i));
+		__m256i vr = scalar_first? array_apply_avx2(op, vb, va) : array_apply_avx2(op, va, vb);
+		_mm256_storeu_si256((__m256i*)(out + i), vr);
+	}
+
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t array_sum_avx2(const int64_t *buf, size_t size, int64_t *ret) {
+	__m256i acc = _mm256_setzero_si256();
+	size_t  i   = 0;
+	for (; i + 4 <= size; i += 4)
+		acc = _mm256_add_epi64(acc, _mm256_loadu_si256((const __m256i*)(buf + i)));
+
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	*ret = (int64_t)((uint64_t)lanes[0] + (uint64_t)lanes[1] +
+	                 (uint64_t)lanes[2] + (uint64_t)lanes[3]);
+	return i;
+}
+
+__attribute__((target("avx2")))
+static size_t array_minmax_avx2(const int64_t *buf, size_t size, bool max, int64_t *ret) {
+	if (size < 4)
+		return 0;
+
+	__m256i acc = _mm256_loadu_si256((const __m256i*)buf);
+	size_t  i   = 4;
+	for (; i + 4 <= size; i += 4) {
+		__m256i v  = _mm256_loadu_si256((const __m256i*)(buf + i));
+		__m256i gt = _mm256_cmpgt_epi64(v, acc);
+		acc = max? _mm256_blendv_epi8(acc, v, gt) : _mm256_blendv_epi8(v, acc, gt);
+	}
+
+	int64_t lanes[4];
+	_mm256_storeu_si256((__m256i*)lanes, acc);
+	*ret = lanes[0];
+	for (size_t j = 1; j < 4; ++ j) {
+		if (max? lanes[j] > *ret : lanes[j] < *ret)
+			*ret = lanes[j];
+	}
+	return i;
+}
+#endif
+
+void array_op(array_op_t op, int64_t *out, const int64_t *a, const int64_t *b, size_t size) {
+	size_t i = 0;
+#ifdef ARRAY_AVX2
+	if (array_has_avx2())
+		i = array_op_avx2(op, out, a, b, size);
+#endif
+
+	for (; i < size; ++ i)
+		out[i] = array_apply(op, a[i], b[i]);
+}
+
+void array_op_scalar(array_op_t op, int64_t *out, const int64_t *a, int64_t b, size_t size,
+                     bool scalar_first) {
+	size_t i = 0;
+#ifdef ARRAY_AVX2
+	if (array_has_avx2())
+		i = array_op_scalar_avx2(op, out, a, b, size, scalar_first);
+#endif
+
+	for (; i < size; ++ i)
+		out[i] = scalar_first? array_apply(op, b, a[i]) : array_apply(op, a[i], b);
+}
+
+int64_t array_sum(const int64_t *buf, size_t size) {
+	int64_t sum = 0;
+	size_t  i   = 0;
+#ifdef ARRAY_AVX2
+	if (array_has_avx2())
+		i = array_sum_avx2(buf, size, &sum);
+#endif
+
+	for (; i < size; ++ i)
+		sum = array_apply(ARRAY_ADD, sum, buf[i]);
+
+	return sum;
+}
+
+static int64_t array_minmax(const int64_t *buf, size_t size, bool max) {
+	assert(size > 0);
+
+	int64_t ret = buf[0];
+	size_t  i   = 1;
+#ifdef ARRAY_AVX2
+	if (array_has_avx2() && size >= 4)
+		i = array_minmax_avx2(buf, size, max, &ret);
+#endif
+
+	for (; i < size; ++ i) {
+		if (max? buf[i] > ret : buf[i] < ret)
+			ret = buf[i];
+	}
+	return ret;
+}
+
+int64_t array_min(const int64_t *buf, size_t size) {
+	return array_minmax(buf, size, false);
+}
+
+int64_t array_max(const int64_t *buf, size_t size) {
+	return array_minmax(buf, size, true);
+}
+
+#define ARRAY_SORT_SMALL 64
+
+static void array_insertion_sort(int64_t *buf, size_t size) {
+	for (size_t i = 1; i < size; ++ i) {
+		int64_t val = buf[i];
+		size_t  j   = i;
+		for (; j > 0 && buf[j - 1] > val; -- j)
+			buf[j] = buf[j - 1];
+
+		buf[j] = val;
+	}
+}
+
+/* LSD radix sort on bytes, with the sign bit flipped so negative numbers order first. Passes where
+   every key has the same byte are skipped, which makes small ranges of values cheap */
+void array_sort(int64_t *buf, size_t size) {
+	if (size < ARRAY_SORT_SMALL) {
+		array_insertion_sort(buf, size);
+		return;
+	}
+
+	uint64_t *keys = (uint64_t*)malloc(size * sizeof(uint64_t));
+	uint64_t *tmp  = (uint64_t*)malloc(size * sizeof(uint64_t));
+	assert(keys != NULL && tmp != NULL);
+
+	static const uint64_t sign = (uint64_t)1 << 63;
+	for (size_t i = 0; i < size; ++ i)
+		keys[i] = (uint64_t)buf[i] ^ sign;
+
+	for (size_t shift = 0; shift < 64; shift += 8) {
+		size_t counts[256] = {0};
+		for (size_t i = 0; i < size; ++ i)
+			++ counts[(keys[i] >> shift) & 0xFF];
+
+		if (counts[(keys[0] >> shift) & 0xFF] == size)
+			continue;
+
+		size_t pos = 0;
+		for (size_t i = 0; i < 256; ++ i) {
+			size_t count = counts[i];
+			counts[i] = pos;
+			pos      += count;
+		}
+
+		for (size_t i = 0; i < size; ++ i)
+			tmp[counts[(keys[i] >> shift) & 0xFF] ++] = keys[i];
+
+		uint64_t *swap = keys;
+		keys = tmp;
+		tmp  = swap;
+	}
+
+	for (size_t i = 0; i < size; ++ i)
+		buf[i] = (int64_t)(keys[i] ^ sign);
+
+	free(keys);
+	free(tmp);
+}
@@ -0,0 +1,39 @@
+#ifndef ARRAY_H_HEADER_GUARD
+#define ARRAY_H_HEADER_GUARD
+
+#include <stdint.h>  /* int64_t, uint64_t */
+#include <stdlib.h>  /* size_t */
+#include <string.h>  /* memcpy */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "arena.h"
+
+/* Arrays are immutable, every operation creates a new array in the arena */
+typedef struct {
+	size_t  size;
+	int64_t buf[];
+} array_t;
+
+array_t *array_new (arena_t *arena, size_t size);
+array_t *array_copy(arena_t *arena, const array_t *arr);
+
+typedef enum {
+	ARRAY_ADD = 0,
+	ARRAY_SUB,
+	ARRAY_MUL,
+} array_op_t;
+
+/* Element-wise operations. The arrays must be the same size, for the scalar versions the scalar
+   is the left operand if scalar_first is set */
+void array_op       (array_op_t op, int64_t *out, const int64_t *a, const int64_t *b, size_t size);
+void array_op_scalar(array_op_t op, int64_t *out, const int64_t *a, int64_t b, size_t size,
+                     bool scalar_first);
+
+int64_t array_sum(const int64_t *buf, size_t size);
+int64_t array_min(const int64_t *buf, size_t size);
+int64_t array_max(const int64_t *buf, size_t size);
+
+void array_sort(int64_t *buf, size_t size);
+
+#endif
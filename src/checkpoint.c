@@ -0,0 +1,541 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h> /* fork, _exit, write, close */
+#include <fcntl.h>  /* open, O_WRONLY, O_CREAT, O_TRUNC */
+#include <errno.h>  /* errno, EINTR */
+
+#include "checkpoint.h"
+
+static const char *checkpoint_err_to_cstr_map[CHECKPOINT_ERRS_COUNT] = {
+	[CHECKPOINT_OK] = "Ok",
+
+	[CHECKPOINT_ERR_OPEN]    = "Failed to open",
+	[CHECKPOINT_ERR_FORMAT]  = "Malformed checkpoint",
+	[CHECKPOINT_ERR_VERSION] = "Unsupported checkpoint version",
+	[CHECKPOINT_ERR_STALE]   = "Taken of a different program",
+};
+
+const char *checkpoint_err_to_cstr(checkpoint_err_t err) {
+	assert(err < CHECKPOINT_ERRS_COUNT && err >= 0);
+	return checkpoint_err_to_cstr_map[err];
+}
+
+static char *checkpoint_tmp_path(const char *path) {
+	size_t len = strlen(path);
+	char  *tmp = (char*)malloc(len + sizeof(".tmp"));
+	assert(tmp != NULL);
+	memcpy(tmp, path, len);
+	memcpy(tmp + len, ".tmp", sizeof(".tmp"));
+	return tmp;
+}
+
+void checkpoint_init(checkpoint_t *c, const char *path, size_t every, uint64_t hash) {
+	assert(every > 0);
+
+	ZERO_STRUCT(c);
+	c->path  = path;
+	c->every = every;
+	c->hash  = hash;
+	c->tmp   = checkpoint_tmp_path(path);
+}
+
+/* Maps in the order they are listed in the file. The table is sized before the fork, the child
+   can not grow it */
+typedef struct {
+	map_t **buf;
+	size_t  size, cap;
+} maps_t;
+
+/* Searched linearly, programs rarely keep more than a few maps around */
+static size_t checkpoint_map_index(maps_t *maps, map_t *map) {
+	for (size_t i = 0; i < maps->size; ++ i) {
+		if (maps->buf[i] == map)
+			return i;
+	}
+
+	return SIZE_MAX;
+}
+
+static size_t checkpoint_count_maps(data_t *vals, size_t size) {
+	size_t count = 0;
+	for (size_t i = 0; i < size; ++ i)
+		count += vals[i].type == DATA_MAP;
+
+	return count;
+}
+
+static void checkpoint_add_maps(maps_t *maps, data_t *vals, size_t size) {
+	for (size_t i = 0; i < size; ++ i) {
+		if (vals[i].type != DATA_MAP || checkpoint_map_index(maps, vals[i].as.map) != SIZE_MAX)
+			continue;
+
+		assert(maps->size < maps->cap);
+		maps->buf[maps->size ++] = vals[i].as.map;
+	}
+}
+
+/* Buffered output made of nothing but write calls. The forked child serializes through it, other
+   threads of the parent might have held the locks of malloc and stdio during the fork */
+typedef struct {
+	int    fd;
+	char  *buf; /* CHECKPOINT_BUF_SIZE bytes */
+	size_t size;
+	bool   failed;
+} checkpoint_out_t;
+
+static void checkpoint_flush(checkpoint_out_t *out) {
+	for (size_t written = 0; written < out->size && !out->failed;) {
+		ssize_t n = write(out->fd, out->buf + written, out->size - written);
+		if (n == -1 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			out->failed = true;
+		else
+			written += (size_t)n;
+	}
+
+	out->size = 0;
+}
+
+static void checkpoint_bytes(checkpoint_out_t *out, const char *buf, size_t len) {
+	while (len > 0) {
+		if (out->size == CHECKPOINT_BUF_SIZE)
+			checkpoint_flush(out);
+
+		size_t n = CHECKPOINT_BUF_SIZE - out->size;
+		if (n > len)
+			n = len;
+
+		memcpy(out->buf + out->size, buf, n);
+		out->size += n;
+		buf       += n;
+		len       -= n;
+	}
+}
+
+static void checkpoint_cstr(checkpoint_out_t *out, const char *cstr) {
+	checkpoint_bytes(out, cstr, strlen(cstr));
+}
+
+static void checkpoint_char(checkpoint_out_t *out, char ch) {
+	checkpoint_bytes(out, &ch, 1);
+}
+
+/* Digits are made backwards, 20 fit any 64 bit value */
+static void checkpoint_uint(checkpoint_out_t *out, uint64_t val, unsigned base, size_t width) {
+	char   digits[20];
+	size_t len = 0;
+	do {
+		digits[sizeof(digits) - ++ len] = "0123456789abcdef"[val % base];
+		val /= base;
+	} while (val > 0 || len < width);
+
+	checkpoint_bytes(out, digits + sizeof(digits) - len, len);
+}
+
+static void checkpoint_int(checkpoint_out_t *out, int64_t val) {
+	if (val < 0)
+		checkpoint_char(out, '-');
+
+	checkpoint_uint(out, val < 0? 0 - (uint64_t)val : (uint64_t)val, 10, 0);
+}
+
+/* A line of a name and a value */
+static void checkpoint_field(checkpoint_out_t *out, const char *name, size_t val) {
+	checkpoint_cstr(out, name);
+	checkpoint_char(out, ' ');
+	checkpoint_uint(out, val, 10, 0);
+	checkpoint_char(out, '\n');
+}
+
+static void checkpoint_write_data(checkpoint_out_t *out, data_t *data, maps_t *maps) {
+	switch (data->type) {
+	case DATA_INT:
+		checkpoint_cstr(out, "i ");
+		checkpoint_int(out, data->as.int_);
+		break;
+
+	case DATA_STR:
+		checkpoint_cstr(out, "s ");
+		checkpoint_uint(out, data->as.str.len, 10, 0);
+		checkpoint_char(out, ' ');
+		checkpoint_bytes(out, data->as.str.ptr->buf, data->as.str.len);
+		break;
+
+	case DATA_ARRAY:
+		checkpoint_cstr(out, "a ");
+		checkpoint_uint(out, data->as.arr->size, 10, 0);
+		for (size_t i = 0; i < data->as.arr->size; ++ i) {
+			checkpoint_char(out, ' ');
+			checkpoint_int(out, data->as.arr->buf[i]);
+		}
+		break;
+
+	case DATA_MAP:
+		checkpoint_cstr(out, "m ");
+		checkpoint_uint(out, checkpoint_map_index(maps, data->as.map), 10, 0);
+		break;
+
+	/* checkpoint_tick never saves an env that can reach a channel */
+	default: assert(0);
+	}
+}
+
+static void checkpoint_write_vals(checkpoint_out_t *out, const char *name, data_t *vals,
+                                  size_t size, maps_t *maps) {
+	checkpoint_field(out, name, size);
+	for (size_t i = 0; i < size; ++ i) {
+		checkpoint_write_data(out, &vals[i], maps);
+		checkpoint_char(out, '\n');
+	}
+}
+
+static void checkpoint_write(env_t *e, checkpoint_out_t *out, uint64_t hash, maps_t *maps) {
+	checkpoint_field(out, "emlang-checkpoint", CHECKPOINT_VERSION);
+	checkpoint_cstr(out, "hash ");
+	checkpoint_uint(out, hash, 16, 16);
+	checkpoint_char(out, '\n');
+	checkpoint_field(out, "ems",  e->prog->size);
+	checkpoint_field(out, "ip",   e->ip + 1);
+	checkpoint_field(out, "tick", e->tick);
+
+	checkpoint_cstr(out, "print ");
+	checkpoint_uint(out, e->print, 10, 0);
+	checkpoint_field(out, "", e->print_from);
+
+	checkpoint_field(out, "calls", e->calls_size);
+	for (size_t i = 0; i < e->calls_size; ++ i) {
+		checkpoint_uint(out, e->calls[i].ret,   10, 0);
+		checkpoint_char(out, ' ');
+		checkpoint_uint(out, e->calls[i].print, 10, 0);
+		checkpoint_field(out, "", e->calls[i].print_from);
+	}
+
+	checkpoint_add_maps(maps, e->vars, e->vars_cap);
+	checkpoint_add_maps(maps, e->stack.buf, e->stack.size);
+
+	checkpoint_field(out, "maps", maps->size);
+	for (size_t i = 0; i < maps->size; ++ i) {
+		checkpoint_cstr(out, "map ");
+		checkpoint_uint(out, maps->buf[i]->size, 10, 0);
+
+		size_t      it = 0;
+		map_slot_t *slot;
+		while ((slot = map_next(maps->buf[i], &it)) != NULL) {
+			checkpoint_char(out, ' ');
+			checkpoint_write_data(out, &slot->key, maps);
+			checkpoint_char(out, ' ');
+			checkpoint_write_data(out, &slot->val, maps);
+		}
+		checkpoint_char(out, '\n');
+	}
+
+	checkpoint_write_vals(out, "vars",  e->vars,      e->vars_cap,   maps);
+	checkpoint_write_vals(out, "stack", e->stack.buf, e->stack.size, maps);
+}
+
+/* Runs in the forked child, so it makes no call that could take a lock. The buffer and the table
+   of maps come from the parent */
+static bool checkpoint_write_file(env_t *e, uint64_t hash, const char *tmp, const char *path,
+                                  char *buf, maps_t *maps) {
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+		return false;
+
+	checkpoint_out_t out = {.fd = fd, .buf = buf};
+	checkpoint_write(e, &out, hash, maps);
+	checkpoint_flush(&out);
+
+	bool ok = close(fd) == 0 && !out.failed;
+	return ok && rename(tmp, path) == 0;
+}
+
+static size_t checkpoint_env_maps(env_t *e) {
+	return checkpoint_count_maps(e->vars, e->vars_cap) +
+	       checkpoint_count_maps(e->stack.buf, e->stack.size);
+}
+
+checkpoint_err_t checkpoint_save(env_t *e, const char *path, uint64_t hash) {
+	maps_t maps = {0};
+	maps.cap    = checkpoint_env_maps(e);
+	maps.buf    = (map_t**)malloc((maps.cap + 1) * sizeof(map_t*));
+	assert(maps.buf != NULL);
+
+	char *buf = (char*)malloc(CHECKPOINT_BUF_SIZE);
+	assert(buf != NULL);
+
+	char            *tmp = checkpoint_tmp_path(path);
+	checkpoint_err_t err = checkpoint_write_file(e, hash, tmp, path, buf, &maps)?
+	                       CHECKPOINT_OK : CHECKPOINT_ERR_OPEN;
+	free(tmp);
+	free(buf);
+	free(maps.buf);
+	return err;
+}
+
+/* Only maps can not be in maps, which is what passing no maps is for */
+static bool checkpoint_read_data(FILE *file, env_t *e, map_t **maps, size_t maps_size,
+                                 data_t *ret) {
+	char tag;
+	if (fscanf(file, " %c", &tag) != 1)
+		return false;
+
+	switch (tag) {
+	case 'i': {
+		long long val;
+		if (fscanf(file, "%lld", &val) != 1)
+			return false;
+
+		*ret = data_new_int((int64_t)val);
+	} break;
+
+	case 's': {
+		size_t len;
+		if (fscanf(file, "%zu", &len) != 1 || fgetc(file) != ' ')
+			return false;
+
+		str_t *str = str_new(&e->arena, len);
+		if (fread(str->buf, 1, len, file) != len)
+			return false;
+
+		str->size = len;
+		*ret      = data_new_str(str);
+	} break;
+
+	case 'a': {
+		size_t size;
+		if (fscanf(file, "%zu", &size) != 1)
+			return false;
+
+		array_t *arr = array_new(&e->arena, size);
+		for (size_t i = 0; i < size; ++ i) {
+			long long val;
+			if (fscanf(file, "%lld", &val) != 1)
+				return false;
+
+			arr->buf[i] = (int64_t)val;
+		}
+
+		*ret = data_new_arr(arr);
+	} break;
+
+	case 'm': {
+		size_t idx;
+		if (fscanf(file, "%zu", &idx) != 1 || idx >= maps_size)
+			return false;
+
+		*ret = data_new_map(maps[idx]);
+	} break;
+
+	default: return false;
+	}
+
+	return true;
+}
+
+static bool checkpoint_read_map(FILE *file, env_t *e, map_t *map) {
+	size_t size;
+	if (fscanf(file, " map %zu", &size) != 1)
+		return false;
+
+	for (size_t i = 0; i < size; ++ i) {
+		data_t key, val;
+		if (!checkpoint_read_data(file, e, NULL, 0, &key) ||
+		    !checkpoint_read_data(file, e, NULL, 0, &val) ||
+		    (key.type != DATA_INT && key.type != DATA_STR))
+			return false;
+
+		map_put(&e->arena, map, &key, &val);
+	}
+
+	return true;
+}
+
+static checkpoint_err_t checkpoint_read(env_t *e, FILE *file, uint64_t hash, map_t ***maps) {
+	int                version, print;
+	unsigned long long file_hash;
+	size_t             size, ip, tick, print_from, calls_size;
+	if (fscanf(file, "emlang-checkpoint %i\n", &version) != 1)
+		return CHECKPOINT_ERR_FORMAT;
+	else if (version != CHECKPOINT_VERSION)
+		return CHECKPOINT_ERR_VERSION;
+	else if (fscanf(file, "hash %llx\nems %zu\n", &file_hash, &size) != 2)
+		return CHECKPOINT_ERR_FORMAT;
+	else if ((uint64_t)file_hash != hash || size != e->prog->size)
+		return CHECKPOINT_ERR_STALE;
+	else if (fscanf(file, "ip %zu\ntick %zu\nprint %i %zu\ncalls %zu", &ip, &tick, &print,
+	                &print_from, &calls_size) != 5 || ip > size ||
+	         calls_size > MAX_CALL_DEPTH)
+		return CHECKPOINT_ERR_FORMAT;
+
+	if (calls_size > e->calls_cap) {
+		e->calls_cap = calls_size;
+		e->calls     = (call_t*)alloc_realloc(ALLOC_STACK, e->calls,
+		                                      e->calls_cap * sizeof(call_t));
+		assert(e->calls != NULL);
+	}
+
+	for (size_t i = 0; i < calls_size; ++ i) {
+		call_t *call = &e->calls[i];
+		int     call_print;
+		if (fscanf(file, "%zu %i %zu", &call->ret, &call_print, &call->print_from) != 3 ||
+		    call->ret >= size)
+			return CHECKPOINT_ERR_FORMAT;
+
+		call->print = call_print;
+	}
+	e->calls_size = calls_size;
+
+	size_t maps_size;
+	if (fscanf(file, " maps %zu", &maps_size) != 1)
+		return CHECKPOINT_ERR_FORMAT;
+
+	/* Every map is made first, values refer to them by index */
+	*maps = (map_t**)malloc((maps_size + 1) * sizeof(map_t*));
+	assert(*maps != NULL);
+	for (size_t i = 0; i < maps_size; ++ i)
+		(*maps)[i] = map_new(&e->arena);
+
+	for (size_t i = 0; i < maps_size; ++ i) {
+		if (!checkpoint_read_map(file, e, (*maps)[i]))
+			return CHECKPOINT_ERR_FORMAT;
+	}
+
+	size_t vars;
+	if (fscanf(file, " vars %zu", &vars) != 1 || vars != e->prog->vars)
+		return CHECKPOINT_ERR_FORMAT;
+
+	env_reserve_vars(e, vars);
+	for (size_t i = 0; i < vars; ++ i) {
+		if (!checkpoint_read_data(file, e, *maps, maps_size, &e->vars[i]))
+			return CHECKPOINT_ERR_FORMAT;
+	}
+
+	size_t stack_size;
+	if (fscanf(file, " stack %zu", &stack_size) != 1)
+		return CHECKPOINT_ERR_FORMAT;
+
+	for (size_t i = 0; i < stack_size; ++ i) {
+		data_t data;
+		if (!checkpoint_read_data(file, e, *maps, maps_size, &data))
+			return CHECKPOINT_ERR_FORMAT;
+
+		stack_push(&e->stack, data);
+	}
+
+	if (print && print_from > stack_size)
+		return CHECKPOINT_ERR_FORMAT;
+
+	e->ip         = ip;
+	e->tick       = tick;
+	e->print      = print;
+	e->print_from = print_from;
+	return CHECKPOINT_OK;
+}
+
+checkpoint_err_t checkpoint_load(env_t *e, const char *path, uint64_t hash) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return CHECKPOINT_ERR_OPEN;
+
+	map_t          **maps = NULL;
+	checkpoint_err_t err  = checkpoint_read(e, file, hash, &maps);
+	free(maps);
+	fclose(file);
+	return err;
+}
+
+/* Tasks and channels can not be saved */
+static bool checkpoint_possible(env_t *e) {
+	if (e->halt)
+		return false;
+
+	for (size_t i = 1; i < e->tasks_size; ++ i) {
+		if (e->tasks[i].state != TASK_FREE)
+			return false;
+	}
+
+	for (size_t i = 0; i < e->stack.size; ++ i) {
+		if (e->stack.buf[i].type == DATA_CHAN)
+			return false;
+	}
+
+	for (size_t i = 0; i < e->vars_cap; ++ i) {
+		if (e->vars[i].type == DATA_CHAN)
+			return false;
+	}
+
+	return true;
+}
+
+static void checkpoint_failed(checkpoint_t *c) {
+	if (!c->warned)
+		fprintf(stderr, "Warning: Failed to write the checkpoint '%s'\n", c->path);
+
+	c->warned = true;
+}
+
+static void checkpoint_reap(checkpoint_t *c, bool block) {
+	int status = reap_child(c->child, block);
+	if (status > 0)
+		return;
+	else if (status < 0)
+		checkpoint_failed(c);
+
+	c->child = 0;
+}
+
+/* A resumed env does not start at tick 0 */
+void checkpoint_tick(checkpoint_t *c, env_t *e) {
+	if (c->next == 0)
+		c->next = e->tick + c->every;
+
+	if (e->tick < c->next)
+		return;
+
+	/* A snapshot that is still being written makes the next one wait */
+	if (c->child != 0) {
+		checkpoint_reap(c, false);
+		if (c->child != 0)
+			return;
+	}
+
+	if (!checkpoint_possible(e))
+		return;
+
+	c->next = e->tick + c->every;
+
+	/* Everything the child needs is allocated before the fork */
+	size_t maps_size = checkpoint_env_maps(e);
+	if (maps_size > c->maps_cap) {
+		c->maps_cap = maps_size;
+		c->maps     = (map_t**)realloc(c->maps, c->maps_cap * sizeof(map_t*));
+		assert(c->maps != NULL);
+	}
+
+	if (c->buf == NULL) {
+		c->buf = (char*)malloc(CHECKPOINT_BUF_SIZE);
+		assert(c->buf != NULL);
+	}
+
+	/* The child serializes its copy-on-write view of the env, the parent only waits for the fork.
+	   The child also must not flush the buffered output of the parent */
+	maps_t maps = {.buf = c->maps, .cap = c->maps_cap};
+	pid_t  pid  = fork();
+	if (pid == 0)
+		_exit(checkpoint_write_file(e, c->hash, c->tmp, c->path, c->buf, &maps)?
+		      EXIT_SUCCESS : EXIT_FAILURE);
+	else if (pid > 0)
+		c->child = pid;
+	else if (!checkpoint_write_file(e, c->hash, c->tmp, c->path, c->buf, &maps))
+		checkpoint_failed(c);
+}
+
+void checkpoint_finish(checkpoint_t *c) {
+	if (c->child != 0)
+		checkpoint_reap(c, true);
+
+	free(c->tmp);
+	free(c->buf);
+	free(c->maps);
+}
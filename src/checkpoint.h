@@ -0,0 +1,90 @@
+#ifndef CHECKPOINT_H_HEADER_GUARD
+#define CHECKPOINT_H_HEADER_GUARD
+
+#include <stdio.h>     /* FILE, fopen, fclose, fprintf, fscanf, fread, rename */
+#include <stdint.h>    /* int64_t, uint64_t */
+#include <stdlib.h>    /* size_t, malloc, realloc, free */
+#include <string.h>    /* memcpy, strlen */
+#include <assert.h>    /* assert */
+#include <stdbool.h>   /* bool, true, false */
+#include <sys/types.h> /* pid_t */
+
+#include "env.h"
+
+/* Bumped whenever the format or the instructions the parser makes change */
+#define CHECKPOINT_VERSION 1
+
+/* Snapshots are written through a buffer of this size */
+#define CHECKPOINT_BUF_SIZE 65536
+
+typedef enum {
+	CHECKPOINT_OK = 0,
+
+	CHECKPOINT_ERR_OPEN,
+	CHECKPOINT_ERR_FORMAT,
+	CHECKPOINT_ERR_VERSION,
+	CHECKPOINT_ERR_STALE,
+
+	CHECKPOINT_ERRS_COUNT,
+} checkpoint_err_t;
+
+const char *checkpoint_err_to_cstr(checkpoint_err_t err);
+
+/* Periodic snapshots of an env, so a long run can be resumed where the last snapshot was taken.
+   A snapshot holds the ip, the tick, the print state, the calls, the variables and the stack,
+   values included, and is only good for the program with the hash it was taken of. Tasks and
+   channels can not be saved, so while other tasks are alive or a channel is reachable the
+   snapshot waits. Input that was read and output that was written are not part of it.
+
+   Snapshots are made and written by a forked child from its copy-on-write view of the env, so the
+   interpreter only waits for the fork. The file is written next to its path and renamed over it,
+   a crash while writing leaves the previous snapshot in place. The file is text:
+
+     emlang-checkpoint VERSION
+     hash HASH
+     ems COUNT
+     ip IP
+     tick TICK
+     print PRINT FROM
+     calls COUNT
+     RET PRINT FROM               (one line per call)
+     maps COUNT
+     map SIZE KEY VAL KEY VAL ... (one line per map)
+     vars COUNT
+     VAL                          (one line per variable)
+     stack COUNT
+     VAL                          (one line per value)
+
+   A VAL is "i INT", "s LEN BYTES", "a LEN INT INT ..." or "m INDEX", maps are listed once since
+   they can be changed in place through every value that refers to them */
+struct checkpoint {
+	const char *path;
+	size_t      every; /* Ticks between snapshots */
+	uint64_t    hash;
+
+	size_t next;  /* Tick the next snapshot is due at, 0 until the env was first seen */
+	pid_t  child; /* Still writing the last snapshot, 0 if none */
+	bool   warned; /* Only the first failed snapshot is reported */
+
+	/* Allocated by the parent, the child can not safely call malloc */
+	char   *tmp;  /* Path the file is written to before it is renamed */
+	char   *buf;  /* CHECKPOINT_BUF_SIZE bytes */
+	map_t **maps; /* Room for every map value of the env */
+	size_t  maps_cap;
+};
+
+void checkpoint_init(checkpoint_t *c, const char *path, size_t every, uint64_t hash);
+
+/* Called by the env between instructions, takes a snapshot if one is due and the env can be
+   saved. The ip has to be the last instruction that ran */
+void checkpoint_tick(checkpoint_t *c, env_t *e);
+
+/* Waits for the snapshot being written, if any, and frees the checkpoint */
+void checkpoint_finish(checkpoint_t *c);
+
+checkpoint_err_t checkpoint_save(env_t *e, const char *path, uint64_t hash);
+
+/* The env has to be loaded with the program already, the values go into its arena */
+checkpoint_err_t checkpoint_load(env_t *e, const char *path, uint64_t hash);
+
+#endif
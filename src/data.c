@@ -1,8 +1,13 @@
 #include "data.h"
+#include "map.h"
+#include "task.h"
 
 static const char *data_type_to_cstr_map[DATA_TYPES_COUNT] = {
-	[DATA_INT] = "int",
-	[DATA_STR] = "str",
+	[DATA_INT]   = "int",
+	[DATA_STR]   = "str",
+	[DATA_ARRAY] = "array",
+	[DATA_MAP]   = "map",
+	[DATA_CHAN]  = "chan",
 };
 
 const char *data_type_to_cstr(data_type_t type) {
@@ -10,6 +15,32 @@ const char *data_type_to_cstr(data_type_t type) {
 	return data_type_to_cstr_map[type];
 }
 
+static void data_fprintf_arr(array_t *arr, FILE *file) {
+	fputc('[', file);
+	for (size_t i = 0; i < arr->size; ++ i)
+		fprintf(file, i > 0? " %lli" : "%lli", (long long)arr->buf[i]);
+	fputc(']', file);
+}
+
+static void data_fprintf_map(map_t *map, FILE *file) {
+	fputc('{', file);
+
+	size_t      it    = 0;
+	bool        first = true;
+	map_slot_t *slot;
+	while ((slot = map_next(map, &it)) != NULL) {
+		if (!first)
+			fputs(", ", file);
+
+		data_fprintf(&slot->key, file);
+		fputs(": ", file);
+		data_fprintf(&slot->val, file);
+		first = false;
+	}
+
+	fputc('}', file);
+}
+
 #ifdef DEBUG
 void data_fprintf(data_t *data, FILE *file) {
 	assert(data != NULL);
@@ -17,8 +48,15 @@ void data_fprintf(data_t *data, FILE *file) {
 
 	fprintf(file ,"[%s ", data_type_to_cstr(data->type));
 	switch (data->type) {
-	case DATA_INT: fprintf(file, "%i",   (int)data->as.int_); break;
-	case DATA_STR: fprintf(file, "'%s'", data->as.str);       break;
+	case DATA_INT: fprintf(file, "%lli", (long long)data->as.int_); break;
+	case DATA_STR:
+		fputc('\'', file);
+		fwrite(data->as.str.ptr->buf, 1, data->as.str.len, file);
+		fputc('\'', file);
+		break;
+	case DATA_ARRAY: data_fprintf_arr(data->as.arr, file); break;
+	case DATA_MAP:   data_fprintf_map(data->as.map, file); break;
+	case DATA_CHAN:  fputs("<~>", file); break;
 
 	default: assert(0);
 	}
@@ -30,8 +68,11 @@ void data_fprintf(data_t *data, FILE *file) {
 	assert(file != NULL);
 
 	switch (data->type) {
-	case DATA_INT: fprintf(file, "%i", (int)data->as.int_); break;
-	case DATA_STR: fprintf(file, "%s", data->as.str);       break;
+	case DATA_INT: fprintf(file, "%lli", (long long)data->as.int_); break;
+	case DATA_STR:   fwrite(data->as.str.ptr->buf, 1, data->as.str.len, file); break;
+	case DATA_ARRAY: data_fprintf_arr(data->as.arr, file); break;
+	case DATA_MAP:   data_fprintf_map(data->as.map, file); break;
+	case DATA_CHAN:  fputs("<~>", file); break;
 
 	default: assert(0);
 	}
@@ -46,7 +87,109 @@ data_t data_new_int(int64_t val) {
 	return (data_t){.as = {.int_ = val}, .type = DATA_INT};
 }
 
-data_t data_new_str(char *val) {
+data_t data_new_str(str_t *val) {
+	assert(val != NULL);
+	return (data_t){.as = {.str = {.ptr = val, .len = val->size}}, .type = DATA_STR};
+}
+
+data_t data_new_arr(array_t *val) {
+	assert(val != NULL);
+	return (data_t){.as = {.arr = val}, .type = DATA_ARRAY};
+}
+
+data_t data_new_map(map_t *val) {
+	assert(val != NULL);
+	return (data_t){.as = {.map = val}, .type = DATA_MAP};
+}
+
+data_t data_new_chan(chan_t *val) {
 	assert(val != NULL);
-	return (data_t){.as = {.str = val}, .type = DATA_STR};
+	return (data_t){.as = {.chan = val}, .type = DATA_CHAN};
+}
+
+bool data_in_arena(data_t *data) {
+	switch (data->type) {
+	case DATA_STR:   return !data->as.str.ptr->lit;
+	case DATA_ARRAY: case DATA_MAP: case DATA_CHAN: return true;
+
+	default: return false;
+	}
+}
+
+data_t data_copy(arena_t *arena, data_t *data) {
+	if (!data_in_arena(data))
+		return *data;
+
+	switch (data->type) {
+	case DATA_STR: {
+		str_t *str = str_new(arena, data->as.str.len);
+		memcpy(str->buf, data->as.str.ptr->buf, data->as.str.len);
+		str->size = data->as.str.len;
+		return data_new_str(str);
+	}
+
+	case DATA_ARRAY: return data_new_arr(array_copy(arena, data->as.arr));
+	case DATA_MAP:   return data_new_map(map_copy(arena, data->as.map));
+	case DATA_CHAN:  return data_new_chan(chan_copy(arena, data->as.chan));
+
+	default: assert(0);
+	}
+
+	return *data;
+}
+
+data_t data_str_cat(arena_t *arena, data_t *a, data_t *b) {
+	assert(a->type == DATA_STR && b->type == DATA_STR);
+
+	str_t *str = str_append(arena, a->as.str.ptr, a->as.str.len,
+	                        b->as.str.ptr->buf, b->as.str.len);
+	data_t data = data_new_str(str);
+	data.as.str.len = a->as.str.len + b->as.str.len;
+	return data;
+}
+
+data_t data_str_slice(arena_t *arena, data_t *str, size_t start, size_t len) {
+	assert(str->type == DATA_STR);
+	assert(start + len <= str->as.str.len);
+
+	/* Prefixes share the buffer, anything else is copied */
+	if (start == 0) {
+		data_t data = *str;
+		data.as.str.len = len;
+		return data;
+	}
+
+	str_t *new = str_new(arena, len);
+	memcpy(new->buf, str->as.str.ptr->buf + start, len);
+	new->size = len;
+	return data_new_str(new);
+}
+
+data_t data_str_from_int(arena_t *arena, int64_t val) {
+	char     buf[24];
+	size_t   pos = sizeof(buf);
+	uint64_t abs = val < 0? -(uint64_t)val : (uint64_t)val;
+	do {
+		buf[-- pos] = '0' + abs % 10;
+		abs /= 10;
+	} while (abs > 0);
+
+	if (val < 0)
+		buf[-- pos] = '-';
+
+	str_t *str = str_new(arena, sizeof(buf) - pos);
+	memcpy(str->buf, buf + pos, sizeof(buf) - pos);
+	str->size = sizeof(buf) - pos;
+	return data_new_str(str);
+}
+
+int data_str_cmp(data_t *a, data_t *b) {
+	assert(a->type == DATA_STR && b->type == DATA_STR);
+
+	size_t len = a->as.str.len < b->as.str.len? a->as.str.len : b->as.str.len;
+	int    cmp = memcmp(a->as.str.ptr->buf, b->as.str.ptr->buf, len);
+	if (cmp == 0)
+		cmp = (a->as.str.len > b->as.str.len) - (a->as.str.len < b->as.str.len);
+
+	return (cmp > 0) - (cmp < 0);
 }
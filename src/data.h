@@ -2,24 +2,41 @@
 #define DATA_H_HEADER_GUARD
 
 #include <stdint.h> /* int64_t */
-#include <stdio.h>  /* fprintf */
+#include <stdio.h>  /* fprintf, fwrite */
 #include <assert.h> /* assert */
 #include <stdlib.h> /* free */
+#include <string.h> /* memcmp */
+
+#include "arena.h"
+#include "str.h"
+#include "array.h"
 
 typedef enum {
 	DATA_INT = 0,
 	DATA_STR,
+	DATA_ARRAY,
+	DATA_MAP,
+	DATA_CHAN,
 
 	DATA_TYPES_COUNT,
 } data_type_t;
 
 const char *data_type_to_cstr(data_type_t type);
 
+typedef struct map  map_t;  /* In map.h */
+typedef struct chan chan_t; /* In task.h */
+
 typedef struct {
 	data_type_t type;
 	union {
 		int64_t int_;
-		char   *str;
+		struct {
+			str_t *ptr;
+			size_t len;
+		} str;
+		array_t *arr;
+		map_t   *map;
+		chan_t  *chan;
 	} as;
 } data_t;
 
@@ -27,6 +44,21 @@ void data_fprintf(data_t *data, FILE *file);
 
 data_t data_new(data_type_t type);
 data_t data_new_int(int64_t val);
-data_t data_new_str(char   *val);
+data_t data_new_str(str_t  *val);
+data_t data_new_arr(array_t *val);
+data_t data_new_map(map_t   *val);
+data_t data_new_chan(chan_t *val);
+
+/* Whether the data points into an arena, used to tell if an arena is safe to reset */
+bool data_in_arena(data_t *data);
+
+/* Deep copy into the arena. Channels can not be shared between threads, so a copied channel is a
+   new empty one */
+data_t data_copy(arena_t *arena, data_t *data);
+
+data_t data_str_cat     (arena_t *arena, data_t *a, data_t *b);
+data_t data_str_slice   (arena_t *arena, data_t *str, size_t start, size_t len);
+data_t data_str_from_int(arena_t *arena, int64_t val);
+int    data_str_cmp     (data_t *a, data_t *b);
 
 #endif
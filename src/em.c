@@ -22,12 +22,58 @@ static const char *em_type_to_cstr_map[EM_TYPES_COUNT] = {
 
 	[EM_LOOP_BEGIN] = "loop_begin",
 	[EM_LOOP_END]   = "loop_end",
+	[EM_LOOP_TEST]  = "loop_test",
+	[EM_LOOP_STEP]  = "loop_step",
+	[EM_PUSH_OP]    = "push_op",
+	[EM_PUSH_DUP]   = "push_dup",
+
+	[EM_SPAWN_BEGIN] = "spawn_begin",
+	[EM_SPAWN_END]   = "spawn_end",
+
+	[EM_TASK_BEGIN] = "task_begin",
+	[EM_TASK_END]   = "task_end",
+
+	[EM_DEF_BEGIN] = "def_begin",
+	[EM_DEF_END]   = "def_end",
+	[EM_CALL]      = "call",
 
 	[EM_EXIT] = "exit",
 
 	[EM_DUP]  = "dup",
 	[EM_SWAP] = "swap",
 
+	[EM_LOAD]  = "load",
+	[EM_STORE] = "store",
+
+	[EM_CAT]    = "cat",
+	[EM_LEN]    = "len",
+	[EM_CMP]    = "cmp",
+	[EM_SLICE]  = "slice",
+	[EM_TO_STR] = "to_str",
+
+	[EM_PACK]  = "pack",
+	[EM_INDEX] = "index",
+	[EM_SUM]   = "sum",
+	[EM_MIN]   = "min",
+	[EM_MAX]   = "max",
+	[EM_SORT]  = "sort",
+
+	[EM_MAP_NEW] = "map_new",
+	[EM_MAP_PUT] = "map_put",
+	[EM_MAP_GET] = "map_get",
+	[EM_MAP_HAS] = "map_has",
+	[EM_MAP_DEL] = "map_del",
+
+	[EM_YIELD]    = "yield",
+	[EM_CHAN_NEW] = "chan_new",
+	[EM_SEND]     = "send",
+	[EM_RECV]     = "recv",
+
+	[EM_READ_INT]   = "read_int",
+	[EM_READ_TOKEN] = "read_token",
+	[EM_READ_LINE]  = "read_line",
+	[EM_OPEN]       = "open",
+
 #ifdef DEBUG
 	[EM_DEBUG] = "debug",
 #endif
@@ -46,7 +92,16 @@ em_t em_new_with_data(em_type_t type, data_t data) {
 	return (em_t){.data = data, .type = type};
 }
 
-void em_fprintf(em_t *em, FILE *file) {
+em_t em_copy(const em_t *em) {
+	em_t copy = *em;
+	if (em->data.type == DATA_STR)
+		copy.data = data_new_str(str_new_lit(em->data.as.str.ptr->buf, em->data.as.str.len));
+
+	return copy;
+}
+
+void em_fprintf(program_t *prog, em_t *em, FILE *file) {
+	assert(prog != NULL);
 	assert(em   != NULL);
 	assert(file != NULL);
 
@@ -62,14 +117,72 @@ void em_fprintf(em_t *em, FILE *file) {
 		fprintf(file, " %s", em->data.as.int_ == DATA_STDOUT? "stdout" : "stderr");
 		break;
 
-	case EM_PRINT_BEGIN: case EM_IF_BEGIN:
+	case EM_PRINT_BEGIN: case EM_IF_BEGIN: case EM_SPAWN_BEGIN: case EM_TASK_BEGIN:
+		fprintf(file, " ref: %zu", em->ref);
+		break;
+
+	case EM_DEF_BEGIN: case EM_CALL: case EM_LOAD: case EM_STORE:
+		fprintf(file, " ");
+		data_fprintf(&em->data, file);
 		fprintf(file, " ref: %zu", em->ref);
 		break;
 
 	default: break;
 	}
 
-	fprintf(file, " %s:%zu:%zu>\n", em->path, em->row, em->col);
+	location_t loc = program_locate(prog, em);
+	fprintf(file, " %s:%zu:%zu>\n", loc.path, loc.row, loc.col);
+}
+
+static bool em_has_ref(em_type_t type) {
+	switch (type) {
+	case EM_PRINT_BEGIN: case EM_PRINT_END: case EM_IF_BEGIN: case EM_IF_END:
+	case EM_LOOP_BEGIN:  case EM_LOOP_END:  case EM_SPAWN_BEGIN: case EM_SPAWN_END:
+	case EM_TASK_BEGIN:  case EM_TASK_END:  case EM_DEF_BEGIN: case EM_DEF_END:
+	case EM_CALL: case EM_LOAD: case EM_STORE:
+		return true;
+
+	default: return false;
+	}
+}
+
+/* The fused instructions keep the int they stand in for */
+static bool em_has_data(em_type_t type) {
+	switch (type) {
+	case EM_PUSH: case EM_PUSH_OP: case EM_PUSH_DUP: case EM_LOOP_TEST: case EM_LOOP_STEP:
+	case EM_PRINT_END: case EM_DEF_BEGIN: case EM_CALL: case EM_LOAD: case EM_STORE:
+		return true;
+
+	default: return false;
+	}
+}
+
+void program_fprintf(program_t *prog, FILE *file) {
+	assert(prog != NULL);
+	assert(file != NULL);
+
+	fprintf(file, "ems %zu\n", prog->size);
+	for (size_t i = 0; i < prog->size; ++ i) {
+		em_t *em = &prog->ems[i];
+		fprintf(file, "%zu %s ", i, em_type_to_cstr(em->type));
+
+		if (em_has_ref(em->type))
+			fprintf(file, "%zu ", em->ref);
+		else
+			fputs("- ", file);
+
+		if (!em_has_data(em->type))
+			fputs("- ", file);
+		else if (em->data.type == DATA_STR) {
+			fprintf(file, "s %zu ", em->data.as.str.len);
+			fwrite(em->data.as.str.ptr->buf, 1, em->data.as.str.len, file);
+			fputc(' ', file);
+		} else
+			fprintf(file, "i %lli ", (long long)em->data.as.int_);
+
+		location_t loc = program_locate(prog, em);
+		fprintf(file, "%s:%zu:%zu\n", loc.path, loc.row, loc.col);
+	}
 }
 
 program_t program_new(size_t cap) {
@@ -77,7 +190,7 @@ program_t program_new(size_t cap) {
 
 	program_t prog = {0};
 	prog.cap = cap;
-	prog.ems = (em_t*)malloc(prog.cap * sizeof(em_t));
+	prog.ems = (em_t*)alloc_malloc(ALLOC_PROGRAM, prog.cap * sizeof(em_t));
 	assert(prog.ems != NULL);
 	return prog;
 }
@@ -86,7 +199,15 @@ void program_destroy(program_t *prog) {
 	assert(prog != NULL);
 	assert(prog->ems != NULL);
 
-	free(prog->ems);
+	/* String literals are owned by the program */
+	for (size_t i = 0; i < prog->size; ++ i) {
+		if (prog->ems[i].data.type == DATA_STR)
+			alloc_free(prog->ems[i].data.as.str.ptr);
+	}
+
+	alloc_free(prog->ems);
+	if (prog->src != NULL)
+		source_release(prog->src);
 }
 
 void program_push(program_t *prog, em_t em) {
@@ -94,9 +215,33 @@ void program_push(program_t *prog, em_t em) {
 
 	if (prog->size >= prog->cap) {
 		prog->cap *= 2;
-		prog->ems  = (em_t*)realloc(prog->ems, prog->cap * sizeof(em_t));
+		prog->ems  = (em_t*)alloc_realloc(ALLOC_PROGRAM, prog->ems, prog->cap * sizeof(em_t));
 		assert(prog->ems != NULL);
 	}
 
 	prog->ems[prog->size ++] = em;
 }
+
+void program_replace(program_t *prog, size_t from, size_t to, program_t *with) {
+	assert(from <= to && to <= prog->size);
+
+	size_t tail = prog->size - to, size = from + with->size + tail;
+	if (size > prog->cap) {
+		while (prog->cap < size)
+			prog->cap *= 2;
+
+		prog->ems = (em_t*)alloc_realloc(ALLOC_PROGRAM, prog->ems, prog->cap * sizeof(em_t));
+		assert(prog->ems != NULL);
+	}
+
+	memmove(prog->ems + from + with->size, prog->ems + to, tail * sizeof(em_t));
+	memcpy(prog->ems + from, with->ems, with->size * sizeof(em_t));
+	prog->size = size;
+
+	alloc_free(with->ems);
+}
+
+location_t program_locate(program_t *prog, em_t *em) {
+	assert(prog->src != NULL);
+	return source_locate(prog->src, em->off);
+}
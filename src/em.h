@@ -9,6 +9,8 @@
 
 #include "data.h"
 #include "utils.h"
+#include "alloc.h"
+#include "source.h"
 
 typedef enum {
 	EM_PUSH = 0,
@@ -32,12 +34,58 @@ typedef enum {
 
 	EM_LOOP_BEGIN,
 	EM_LOOP_END,
+	EM_LOOP_TEST, /* Replaces the "0 :D N :<" before @: of a counted loop, see opt.h */
+	EM_LOOP_STEP, /* Same, but also does the "K ;)" after :@ */
+	EM_PUSH_OP,   /* Pushes an int and runs the arithmetic or comparison after it */
+	EM_PUSH_DUP,  /* Pushes an int and runs the :D after it */
+
+	EM_SPAWN_BEGIN,
+	EM_SPAWN_END,
+
+	EM_TASK_BEGIN,
+	EM_TASK_END,
+
+	EM_DEF_BEGIN,
+	EM_DEF_END,
+	EM_CALL,
 
 	EM_EXIT,
 
 	EM_DUP,
 	EM_SWAP,
 
+	EM_LOAD,
+	EM_STORE,
+
+	EM_CAT,
+	EM_LEN,
+	EM_CMP,
+	EM_SLICE,
+	EM_TO_STR,
+
+	EM_PACK,
+	EM_INDEX,
+	EM_SUM,
+	EM_MIN,
+	EM_MAX,
+	EM_SORT,
+
+	EM_MAP_NEW,
+	EM_MAP_PUT,
+	EM_MAP_GET,
+	EM_MAP_HAS,
+	EM_MAP_DEL,
+
+	EM_YIELD,
+	EM_CHAN_NEW,
+	EM_SEND,
+	EM_RECV,
+
+	EM_READ_INT,
+	EM_READ_TOKEN,
+	EM_READ_LINE,
+	EM_OPEN,
+
 #ifdef DEBUG
 	EM_DEBUG,
 #endif
@@ -54,21 +102,23 @@ typedef struct {
 	data_t    data;
 	em_type_t type;
 
-	const char *path;
-	size_t      row, col;
-
-	size_t ref;
-	bool   ran;
+	size_t off; /* Byte offset in the source, see program_locate */
+	size_t ref; /* Matching end or begin of a block, called subroutine or variable slot */
 } em_t;
 
 em_t em_new(em_type_t type);
 em_t em_new_with_data(em_type_t type, data_t data);
 
-void em_fprintf(em_t *em, FILE *file);
+/* Copies an instruction along with the string literal it holds, so both copies can be freed */
+em_t em_copy(const em_t *em);
 
 typedef struct {
 	em_t  *ems;
 	size_t cap, size;
+
+	size_t vars; /* How many variable slots the instructions use */
+
+	source_t *src; /* Holds a reference, NULL until the parser loads input */
 } program_t;
 
 #define DEFAULT_PROGRAM_CAP 256
@@ -77,4 +127,20 @@ program_t program_new    (size_t cap);
 void      program_destroy(program_t *prog);
 void      program_push   (program_t *prog, em_t em);
 
+/* Replaces the instructions from from up to to with the instructions of with, which are moved */
+void program_replace(program_t *prog, size_t from, size_t to, program_t *with);
+
+location_t program_locate(program_t *prog, em_t *em);
+
+void em_fprintf(program_t *prog, em_t *em, FILE *file);
+
+/* Writes the instructions as text, one per line, so tools can read them back:
+
+     ems COUNT
+     IDX TYPE REF VAL PATH:ROW:COL
+
+   TYPE is the name em_type_to_cstr gives, REF is "-" for instructions that refer to nothing. VAL
+   is "-", "i INT" or "s LEN BYTES", the location is the rest of the line */
+void program_fprintf(program_t *prog, FILE *file);
+
 #endif
@@ -1,4 +1,5 @@
 #include "env.h"
+#include "checkpoint.h"
 
 const char *runtime_err_to_cstr_map[RUNTIME_ERRS_COUNT] = {
 	[RUNTIME_OK] = "Ok",
@@ -7,7 +8,13 @@ const char *runtime_err_to_cstr_map[RUNTIME_ERRS_COUNT] = {
 	[RUNTIME_ERR_INVALID_ACCESS]  = "Invalid access",
 	[RUNTIME_ERR_DIV_BY_ZERO]     = "Division by zero",
 
-	[RUNTIME_ERR_INCORRECT_TYPE] = "Incorrect type",
+	[RUNTIME_ERR_INCORRECT_TYPE]      = "Incorrect type",
+	[RUNTIME_ERR_CALL_STACK_OVERFLOW] = "Call stack overflow",
+	[RUNTIME_ERR_DEADLOCK]            = "Every task is blocked",
+
+	[RUNTIME_ERR_TICK_LIMIT]  = "Tick limit exceeded",
+	[RUNTIME_ERR_STACK_LIMIT] = "Stack limit exceeded",
+	[RUNTIME_ERR_MEM_LIMIT]   = "Memory limit exceeded",
 };
 
 const char *runtime_err_to_cstr(runtime_err_t err) {
@@ -23,30 +30,136 @@ runtime_result_t runtime_result_err(runtime_err_t err, em_t *em) {
 	return (runtime_result_t){.err = err, .em = em};
 }
 
-env_t *env_new(size_t stack_cap, size_t popped_cap) {
+env_t *env_new(size_t stack_cap) {
 	env_t *e = (env_t*)malloc(sizeof(env_t));
 	assert(e != NULL);
 	ZERO_STRUCT(e);
 
-	e->stack = stack_new(stack_cap, popped_cap);
+	e->stack        = stack_new(stack_cap);
+	e->arena        = arena_new();
+	e->gc_threshold = GC_MIN_THRESHOLD;
+	e->in_fd        = STDIN_FILENO;
+	e->out          = stdout;
+	e->err          = stderr;
+	e->dir          = -1;
+	e->ready        = TASK_QUEUE_EMPTY;
+	e->free         = TASK_QUEUE_EMPTY;
 	return e;
 }
 
 void env_destroy(env_t *e) {
+	if (e->in != NULL)
+		reader_destroy(e->in);
+
+	/* The running task is in the env */
+	for (size_t i = 0; i < e->tasks_size; ++ i) {
+		if (i == e->task)
+			continue;
+
+		stack_destroy(&e->tasks[i].stack);
+		alloc_free(e->tasks[i].calls);
+	}
+
+	alloc_free(e->tasks);
+	alloc_free(e->calls);
+	alloc_free(e->vars);
 	stack_destroy(&e->stack);
+	arena_destroy(&e->arena);
 	free(e);
 }
 
-static void env_gc(env_t *e) {
-	for (size_t i = 0; i < e->prog->size; ++ i) {
-		if (e->prog->ems[i].ran)
+static bool env_stack_in_arena(stack_t *stack) {
+	for (size_t i = 0; i < stack->size; ++ i) {
+		if (data_in_arena(&stack->buf[i]))
+			return true;
+	}
+
+	return false;
+}
+
+/* Blocked tasks are queued in a channel, which is in the arena */
+static bool env_roots_in_arena(env_t *e) {
+	if (env_stack_in_arena(&e->stack))
+		return true;
+
+	for (size_t i = 0; i < e->vars_cap; ++ i) {
+		if (data_in_arena(&e->vars[i]))
+			return true;
+	}
+
+	for (size_t i = 0; i < e->tasks_size; ++ i) {
+		task_t *t = &e->tasks[i];
+		if (i == e->task || t->state == TASK_FREE)
 			continue;
+		else if (t->state == TASK_BLOCKED || env_stack_in_arena(&t->stack))
+			return true;
+	}
+
+	return false;
+}
+
+/* Values created at runtime live in the arena, which can only be reset when nothing on a stack, in
+   a variable or in a channel points into it. If something does, wait until the arena doubles
+   before checking again */
+static void env_collect(env_t *e) {
+	if (e->stats != NULL)
+		++ e->stats->gc_runs;
 
-		if (e->prog->ems[i].data.type == DATA_STR)
-			free(e->prog->ems[i].data.as.str);
+	if (env_roots_in_arena(e)) {
+		e->gc_threshold = e->arena.size * 2;
+		return;
 	}
+
+	if (e->stats != NULL) {
+		++ e->stats->gc_resets;
+		e->stats->gc_freed += e->arena.size;
+	}
+
+	arena_reset(&e->arena);
+	e->gc_threshold = GC_MIN_THRESHOLD;
 }
 
+static void env_gc(env_t *e) {
+	if (e->arena.size >= e->gc_threshold)
+		env_collect(e);
+}
+
+/* Room the buffers of a task take, every change to them goes through tasks_mem */
+static size_t env_task_mem(task_t *t) {
+	return t->stack.cap * sizeof(data_t) + t->calls_cap * sizeof(call_t);
+}
+
+/* The task_t of the running task is a stale copy, what it takes is in the env */
+static size_t env_mem(env_t *e) {
+	size_t tasks = e->tasks_cap * sizeof(task_t) + e->tasks_mem;
+	if (e->tasks_size > 0)
+		tasks -= env_task_mem(&e->tasks[e->task]);
+
+	return e->arena.size + e->stack.cap * sizeof(data_t) + e->calls_cap * sizeof(call_t) + tasks;
+}
+
+/* Going over the memory limit first tries to get rid of the garbage */
+static runtime_err_t env_check_limits(env_t *e) {
+	if (e->limits.ticks > 0 && e->tick >= e->limits.ticks)
+		return RUNTIME_ERR_TICK_LIMIT;
+	else if (e->limits.stack > 0 && e->stack.size > e->limits.stack)
+		return RUNTIME_ERR_STACK_LIMIT;
+	else if (e->limits.mem > 0 && env_mem(e) > e->limits.mem) {
+		env_collect(e);
+		if (env_mem(e) > e->limits.mem)
+			return RUNTIME_ERR_MEM_LIMIT;
+	}
+
+	return RUNTIME_OK;
+}
+
+#define CHECK_LIMITS(E, EM) \
+	if ((E)->limited) { \
+		runtime_err_t err = env_check_limits(E); \
+		if (err != RUNTIME_OK) \
+			return runtime_result_err(err, EM); \
+	}
+
 #define STACK_POP(E, RET) \
 	if (stack_pop(&(E)->stack, RET) != 0) \
 		return runtime_result_err(RUNTIME_ERR_STACK_UNDERFLOW, &(E)->prog->ems[(E)->ip])
@@ -59,21 +172,328 @@ static void env_gc(env_t *e) {
 	if (stack_swap(&(E)->stack, OFF) != 0) \
 		return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, &(E)->prog->ems[(E)->ip])
 
-runtime_result_t env_run(env_t *e, program_t *prog) {
+/* Values that are only popped might have been pushed before the print block began */
+#define PRINT_FROM_CLAMP(E) \
+	if ((E)->print && (E)->print_from > (E)->stack.size) \
+		(E)->print_from = (E)->stack.size
+
+/* Slow path of the arithmetic instructions, for when either operand is an array */
+static runtime_err_t env_array_op(env_t *e, array_op_t op, data_t *a, data_t *b) {
+	array_t *arr;
+	if (a->type == DATA_ARRAY && b->type == DATA_ARRAY) {
+		if (a->as.arr->size != b->as.arr->size)
+			return RUNTIME_ERR_INVALID_ACCESS;
+
+		arr = array_new(&e->arena, a->as.arr->size);
+		array_op(op, arr->buf, a->as.arr->buf, b->as.arr->buf, arr->size);
+	} else if (a->type == DATA_ARRAY && b->type == DATA_INT) {
+		arr = array_new(&e->arena, a->as.arr->size);
+		array_op_scalar(op, arr->buf, a->as.arr->buf, b->as.int_, arr->size, false);
+	} else if (a->type == DATA_INT && b->type == DATA_ARRAY) {
+		arr = array_new(&e->arena, b->as.arr->size);
+		array_op_scalar(op, arr->buf, b->as.arr->buf, a->as.int_, arr->size, true);
+	} else
+		return RUNTIME_ERR_INCORRECT_TYPE;
+
+	stack_push(&e->stack, data_new_arr(arr));
+	return RUNTIME_OK;
+}
+
+static reader_t *env_input(env_t *e) {
+	if (e->in == NULL && !e->no_stdin)
+		e->in = reader_new(e->in_fd);
+
+	return e->in;
+}
+
+static data_t env_new_str(env_t *e, const char *text, size_t len) {
+	str_t *str = str_new(&e->arena, len);
+	memcpy(str->buf, text, len);
+	str->size = len;
+	return data_new_str(str);
+}
+
+/* Task 0 only gets its place once there is a second task */
+static void env_tasks_init(env_t *e) {
+	if (e->tasks_size > 0)
+		return;
+
+	e->tasks_cap = 16;
+	e->tasks     = (task_t*)alloc_malloc(ALLOC_STACK, e->tasks_cap * sizeof(task_t));
+	assert(e->tasks != NULL);
+
+	ZERO_STRUCT(&e->tasks[0]);
+	e->tasks[0].state = TASK_RUNNING;
+	e->tasks_size     = 1;
+	e->task           = 0;
+}
+
+static void env_task_save(env_t *e) {
+	task_t *t = &e->tasks[e->task];
+	e->tasks_mem -= env_task_mem(t);
+
+	t->prog       = e->prog;
+	t->ip         = e->ip;
+	t->stack      = e->stack;
+	t->calls      = e->calls;
+	t->calls_size = e->calls_size;
+	t->calls_cap  = e->calls_cap;
+	t->print      = e->print;
+	t->print_from = e->print_from;
+
+	e->tasks_mem += env_task_mem(t);
+}
+
+static void env_task_load(env_t *e, size_t id) {
+	task_t *t = &e->tasks[id];
+	t->state      = TASK_RUNNING;
+	e->task       = id;
+	e->prog       = t->prog;
+	e->ip         = t->ip;
+	e->stack      = t->stack;
+	e->calls      = t->calls;
+	e->calls_size = t->calls_size;
+	e->calls_cap  = t->calls_cap;
+	e->print      = t->print;
+	e->print_from = t->print_from;
+}
+
+static void env_task_wake(env_t *e, size_t id) {
+	e->tasks[id].state = TASK_READY;
+	task_queue_push(e->tasks, &e->ready, id);
+}
+
+/* Switches to the next ready task, the running task has to be saved and queued already. After the
+   main task ended it is switched back to once no task is ready, before that it is a deadlock */
+static runtime_result_t env_task_next(env_t *e, em_t *em) {
+	size_t id = task_queue_pop(e->tasks, &e->ready);
+	if (id == TASK_NONE) {
+		if (!e->main_done)
+			return runtime_result_err(RUNTIME_ERR_DEADLOCK, em);
+
+		id = 0;
+	}
+
+	env_task_load(e, id);
+	return runtime_result_ok(0);
+}
+
+static runtime_result_t env_task_yield(env_t *e, em_t *em) {
+	env_task_save(e);
+	env_task_wake(e, e->task);
+	return env_task_next(e, em);
+}
+
+static runtime_result_t env_task_block(env_t *e, task_queue_t *q, data_t val, em_t *em) {
+	env_tasks_init(e);
+	env_task_save(e);
+
+	task_t *t = &e->tasks[e->task];
+	t->state = TASK_BLOCKED;
+	t->val   = val;
+	task_queue_push(e->tasks, q, e->task);
+	return env_task_next(e, em);
+}
+
+/* The task starts right after em, with the popped count of values moved from the top of the stack
+   onto its own */
+static runtime_result_t env_task_spawn(env_t *e, em_t *em) {
+	data_t count;
+	STACK_POP(e, &count);
+	PRINT_FROM_CLAMP(e);
+	if (count.type != DATA_INT)
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+	else if (count.as.int_ < 0)
+		return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+	else if ((uint64_t)count.as.int_ > e->stack.size)
+		return runtime_result_err(RUNTIME_ERR_STACK_UNDERFLOW, em);
+
+	env_tasks_init(e);
+	size_t id = task_queue_pop(e->tasks, &e->free);
+	if (id == TASK_NONE) {
+		if (e->tasks_size >= e->tasks_cap) {
+			e->tasks_cap *= 2;
+			e->tasks      = (task_t*)alloc_realloc(ALLOC_STACK, e->tasks,
+			                                       e->tasks_cap * sizeof(task_t));
+			assert(e->tasks != NULL);
+		}
+
+		id = e->tasks_size ++;
+		ZERO_STRUCT(&e->tasks[id]);
+		e->tasks[id].stack = stack_new(TASK_STACK_CAP);
+		e->tasks_mem      += env_task_mem(&e->tasks[id]);
+	}
+
+	task_t *t = &e->tasks[id];
+	t->prog       = e->prog;
+	t->ip         = e->ip;
+	t->calls_size = 0;
+	t->print      = false;
+
+	size_t from = e->stack.size - (size_t)count.as.int_;
+	e->tasks_mem -= env_task_mem(t);
+	stack_clear(&t->stack);
+	for (size_t i = from; i < e->stack.size; ++ i)
+		stack_push(&t->stack, e->stack.buf[i]);
+
+	e->tasks_mem += env_task_mem(t);
+
+	stack_shrink_to(&e->stack, from);
+	PRINT_FROM_CLAMP(e);
+
+	env_task_wake(e, id);
+	e->ip = em->ref;
+	return runtime_result_ok(0);
+}
+
+/* Stops every task but the main one, which is running again afterwards */
+static void env_tasks_reset(env_t *e) {
+	if (e->tasks_size == 0)
+		return;
+
+	if (e->task != 0) {
+		env_task_save(e);
+		env_task_load(e, 0);
+	}
+
+	e->ready = TASK_QUEUE_EMPTY;
+	e->free  = TASK_QUEUE_EMPTY;
+	for (size_t i = 1; i < e->tasks_size; ++ i) {
+		e->tasks[i].state = TASK_FREE;
+		task_queue_push(e->tasks, &e->free, i);
+	}
+
+	e->tasks[0].state = TASK_RUNNING;
+	++ e->tasks_epoch;
+}
+
+/* Channels still queue the tasks from before the last reset until they are used again */
+static chan_t *env_chan(env_t *e, data_t *data) {
+	chan_t *chan = data->as.chan;
+	if (chan->epoch != e->tasks_epoch) {
+		chan->senders   = TASK_QUEUE_EMPTY;
+		chan->receivers = TASK_QUEUE_EMPTY;
+		chan->epoch     = e->tasks_epoch;
+	}
+
+	return chan;
+}
+
+bool env_tasks_use(env_t *e, program_t *prog) {
+	for (size_t i = 0; i < e->tasks_size; ++ i) {
+		if (i != e->task && e->tasks[i].state != TASK_FREE && e->tasks[i].prog == prog)
+			return true;
+	}
+
+	return false;
+}
+
+void env_load(env_t *e, program_t *prog) {
 	e->ex    = 0;
 	e->prog  = prog;
+	e->ip    = 0;
 	e->halt  = false;
 	e->print = false;
 	e->tick  = 0;
-	for (e->ip = 0; e->ip < e->prog->size && !e->halt; ++ e->ip) {
+
+	e->calls_size = 0;
+}
+
+/* Variables that were never stored to are 0 */
+void env_reserve_vars(env_t *e, size_t count) {
+	if (count <= e->vars_cap)
+		return;
+
+	e->vars = (data_t*)alloc_realloc(ALLOC_STACK, e->vars, count * sizeof(data_t));
+	assert(e->vars != NULL);
+
+	for (size_t i = e->vars_cap; i < count; ++ i)
+		e->vars[i] = data_new_int(0);
+
+	e->vars_cap = count;
+}
+
+void env_unload(env_t *e) {
+	env_tasks_reset(e);
+	for (size_t i = 0; i < e->vars_cap; ++ i)
+		e->vars[i] = data_new_int(0);
+
+	e->calls_size = 0;
+	stack_clear(&e->stack);
+	arena_reset(&e->arena);
+	e->gc_threshold = GC_MIN_THRESHOLD;
+}
+
+static runtime_result_t env_spawn(env_t *e, em_t *em);
+
+#define TASK_SWITCH(CALL) { \
+		runtime_result_t result = CALL; \
+		if (result.err != RUNTIME_OK) \
+			return result; \
+		\
+		stop = e->task == 0? end : SIZE_MAX; \
+	}
+
+/* The instructions a fused loop test stands for still count in the profile, as if they ran. Every
+   value they see is an int */
+static void env_profile_loop(env_t *e, em_t *em, bool loop) {
+	data_t val   = data_new_int(0);
+	size_t tail  = (size_t)(em - e->prog->ems), begin = em[4].ref;
+	for (size_t i = tail + 1; i <= tail + 4; ++ i)
+		profile_hit(e->profile, i, &val);
+
+	profile_hit   (e->profile, begin, &val);
+	profile_branch(e->profile, begin, loop);
+	if (loop && em->type == EM_LOOP_STEP) {
+		profile_hit(e->profile, begin + 1, &val);
+		profile_hit(e->profile, begin + 2, &val);
+	}
+}
+
+/* The env has to be in the main task. Only the main task stops at the end, the other tasks run
+   until the end of their block. Inlined twice, instrumented is constant in both copies, so runs
+   without stats or a profile do not check for them at every instruction */
+static inline __attribute__((always_inline)) runtime_result_t env_exec_loop(env_t *e, size_t end,
+                                                                            bool instrumented) {
+	size_t stop  = end;
+	e->main_done = false;
+
+	for (; !e->halt; ++ e->ip) {
+		/* Subroutines can be defined outside of the range being ran */
+		if (e->ip >= stop && e->calls_size == 0) {
+			if (e->ready.head == TASK_NONE)
+				break;
+
+			/* The main task ended, the other tasks run until they end or block. Tasks continue
+			   after the last instruction they ran */
+			-- e->ip;
+			env_task_save(e);
+			e->main_done = true;
+
+			env_task_load(e, task_queue_pop(e->tasks, &e->ready));
+			stop = SIZE_MAX;
+			continue;
+		}
+
 		em_t *em = &e->prog->ems[e->ip];
-		em->ran  = true;
+		if (instrumented && e->stats != NULL)
+			++ e->stats->ems[em->type];
+
+		if (instrumented && e->profile != NULL)
+			profile_hit(e->profile, e->ip,
+			            e->stack.size > 0? &e->stack.buf[e->stack.size - 1] : NULL);
+
 		switch (em->type) {
 		case EM_PUSH: stack_push(&e->stack, em->data); break;
 		case EM_POP:
 			STACK_POP(e, NULL);
-			if (e->print && e->print_from > e->stack.size)
-				e->print_from = e->stack.size;
+			PRINT_FROM_CLAMP(e);
+			break;
+
+		case EM_LOAD: stack_push(&e->stack, e->vars[em->ref]); break;
+		case EM_STORE:
+			STACK_POP(e, &e->vars[em->ref]);
+			PRINT_FROM_CLAMP(e);
 			break;
 
 #define STACK_POP2_INT(A, B) \
@@ -89,9 +509,22 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 		stack_push(&e->stack, data_new_int(a.as.int_ OP b.as.int_)); \
 	} break
 
-		case EM_ADD: BIN_OP_INST(+);
-		case EM_SUB: BIN_OP_INST(-);
-		case EM_MUL: BIN_OP_INST(*);
+#define ARITH_OP_INST(OP, ARRAY_OP) { \
+		data_t a, b; \
+		STACK_POP(e, &b); \
+		STACK_POP(e, &a); \
+		if (a.type == DATA_INT && b.type == DATA_INT) \
+			stack_push(&e->stack, data_new_int(a.as.int_ OP b.as.int_)); \
+		else { \
+			runtime_err_t err = env_array_op(e, ARRAY_OP, &a, &b); \
+			if (err != RUNTIME_OK) \
+				return runtime_result_err(err, em); \
+		} \
+	} break
+
+		case EM_ADD: ARITH_OP_INST(+, ARRAY_ADD);
+		case EM_SUB: ARITH_OP_INST(-, ARRAY_SUB);
+		case EM_MUL: ARITH_OP_INST(*, ARRAY_MUL);
 		case EM_DIV: {
 			data_t a, b;
 			STACK_POP2_INT(&a, &b);
@@ -106,6 +539,7 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 		case EM_EQU:  BIN_OP_INST(==);
 		case EM_NEQU: BIN_OP_INST(!=);
 
+#undef ARITH_OP_INST
 #undef BIN_OP_INST
 #undef STACK_POP2_INT
 
@@ -113,7 +547,7 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 			if (e->ip == em->ref - 1) {
 				data_t data;
 				STACK_POP(e, &data);
-				FILE *file = e->prog->ems[em->ref].data.as.int_ == DATA_STDOUT? stdout : stderr;
+				FILE *file = e->prog->ems[em->ref].data.as.int_ == DATA_STDOUT? e->out : e->err;
 				data_fprintf(&data, file);
 				fputc('\n', file);
 				fflush(file);
@@ -128,7 +562,7 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 				break;
 
 			e->print   = false;
-			FILE *file = em->data.as.int_ == DATA_STDOUT? stdout : stderr;
+			FILE *file = em->data.as.int_ == DATA_STDOUT? e->out : e->err;
 			for (size_t i = e->print_from; i < e->stack.size; ++ i) {
 				if (i > e->print_from)
 					fputc(' ', file);
@@ -148,6 +582,9 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 		case EM_IF_BEGIN: {
 			data_t cond;
 			STACK_POP_INT(e, cond);
+			if (instrumented && e->profile != NULL)
+				profile_branch(e->profile, e->ip, cond.as.int_);
+
 			if (!cond.as.int_)
 				e->ip = em->ref;
 		} break;
@@ -157,14 +594,154 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 		case EM_LOOP_BEGIN: {
 			data_t cond;
 			STACK_POP_INT(e, cond);
+			if (instrumented && e->profile != NULL)
+				profile_branch(e->profile, e->ip, cond.as.int_);
+
 			if (!cond.as.int_)
 				e->ip = em->ref;
 		} break;
 
 		case EM_LOOP_END:
+			CHECK_LIMITS(e, em);
 			e->ip = em->ref - 1;
 			break;
 
+		/* Does what "0 :D N :< @: :@" (and "K ;)") would, as long as the counter is an int. The
+		   loop end is 4 instructions ahead */
+		case EM_LOOP_TEST: case EM_LOOP_STEP: {
+			data_t *counter = e->stack.size > 0? &e->stack.buf[e->stack.size - 1] : NULL;
+			if (counter == NULL || counter->type != DATA_INT) {
+				stack_push(&e->stack, em->data);
+				break;
+			}
+
+			bool    loop  = false;
+			int64_t bound = em[2].data.as.int_;
+			switch (em[3].type) {
+			case EM_GRT:  loop = counter->as.int_ >  bound; break;
+			case EM_LESS: loop = counter->as.int_ <  bound; break;
+			case EM_EQU:  loop = counter->as.int_ == bound; break;
+			case EM_NEQU: loop = counter->as.int_ != bound; break;
+
+			default: assert(0);
+			}
+
+			/* The :@ it skips still counts */
+			CHECK_LIMITS(e, &em[4]);
+			if (instrumented && e->profile != NULL)
+				env_profile_loop(e, em, loop);
+
+			if (!loop)
+				e->ip += 4;
+			else if (em->type == EM_LOOP_STEP) {
+				counter->as.int_ += e->prog->ems[em[4].ref + 1].data.as.int_;
+				e->ip = em[4].ref + 2;
+			} else
+				e->ip = em[4].ref;
+		} break;
+
+		/* Superinstructions, which take the slow path through the instruction after them when the
+		   types are not right */
+		case EM_PUSH_OP: {
+			data_t *a = e->stack.size > 0? &e->stack.buf[e->stack.size - 1] : NULL;
+			if (a == NULL || a->type != DATA_INT) {
+				stack_push(&e->stack, em->data);
+				break;
+			}
+
+			int64_t b = em->data.as.int_;
+			switch (em[1].type) {
+			case EM_ADD:  a->as.int_ = a->as.int_ +  b; break;
+			case EM_SUB:  a->as.int_ = a->as.int_ -  b; break;
+			case EM_MUL:  a->as.int_ = a->as.int_ *  b; break;
+			case EM_DIV:  a->as.int_ = a->as.int_ /  b; break;
+			case EM_GRT:  a->as.int_ = a->as.int_ >  b; break;
+			case EM_LESS: a->as.int_ = a->as.int_ <  b; break;
+			case EM_EQU:  a->as.int_ = a->as.int_ == b; break;
+			case EM_NEQU: a->as.int_ = a->as.int_ != b; break;
+
+			default: assert(0);
+			}
+
+			if (instrumented && e->profile != NULL)
+				profile_hit(e->profile, e->ip + 1, &em->data);
+
+			++ e->ip;
+		} break;
+
+		case EM_PUSH_DUP:
+			if ((uint64_t)em->data.as.int_ >= e->stack.size) {
+				stack_push(&e->stack, em->data);
+				break;
+			}
+
+			stack_push(&e->stack, e->stack.buf[e->stack.size - 1 - (size_t)em->data.as.int_]);
+			if (instrumented && e->profile != NULL)
+				profile_hit(e->profile, e->ip + 1, &em->data);
+
+			++ e->ip;
+			break;
+
+		case EM_SPAWN_BEGIN: {
+			runtime_result_t result = env_spawn(e, em);
+			if (result.err != RUNTIME_OK)
+				return result;
+		} break;
+
+		case EM_SPAWN_END: break;
+
+		case EM_TASK_BEGIN: {
+			runtime_result_t result = env_task_spawn(e, em);
+			if (result.err != RUNTIME_OK)
+				return result;
+		} break;
+
+		/* Main never gets here, it jumps over the block */
+		case EM_TASK_END:
+			assert(e->task != 0);
+			env_task_save(e);
+			e->tasks[e->task].state = TASK_FREE;
+			task_queue_push(e->tasks, &e->free, e->task);
+			TASK_SWITCH(env_task_next(e, em));
+			break;
+
+		case EM_DEF_BEGIN:
+			e->ip = em->ref;
+			break;
+
+		case EM_DEF_END: {
+			assert(e->calls_size > 0);
+			call_t *call = &e->calls[-- e->calls_size];
+			if (call->print) {
+				size_t from  = e->print? e->print_from : e->stack.size;
+				e->print_from = from < call->print_from? from : call->print_from;
+			}
+
+			e->ip    = call->ret;
+			e->print = call->print;
+		} break;
+
+		case EM_CALL:
+			if (e->calls_size >= MAX_CALL_DEPTH)
+				return runtime_result_err(RUNTIME_ERR_CALL_STACK_OVERFLOW, em);
+
+			CHECK_LIMITS(e, em);
+
+			if (e->calls_size >= e->calls_cap) {
+				e->calls_cap = e->calls_cap == 0? 64 : e->calls_cap * 2;
+				e->calls     = (call_t*)alloc_realloc(ALLOC_STACK, e->calls,
+				                                      e->calls_cap * sizeof(call_t));
+				assert(e->calls != NULL);
+			}
+
+			e->calls[e->calls_size ++] = (call_t){
+				.ret        = e->ip,
+				.print      = e->print,
+				.print_from = e->print_from,
+			};
+			e->ip = em->ref;
+			break;
+
 		case EM_EXIT: {
 			data_t ex;
 			STACK_POP_INT(e, ex);
@@ -184,12 +761,279 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 			STACK_SWAP(e, (size_t)off.as.int_);
 		} break;
 
+#define STACK_POP_STR(E, VAR) \
+	STACK_POP(e, &VAR); \
+	if (VAR.type != DATA_STR) \
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, &e->prog->ems[e->ip]);
+
+		case EM_CAT: {
+			data_t a, b;
+			STACK_POP_STR(e, b);
+			STACK_POP_STR(e, a);
+			stack_push(&e->stack, data_str_cat(&e->arena, &a, &b));
+		} break;
+
+		case EM_LEN: {
+			data_t val;
+			STACK_POP(e, &val);
+			if (val.type == DATA_STR)
+				stack_push(&e->stack, data_new_int((int64_t)val.as.str.len));
+			else if (val.type == DATA_ARRAY)
+				stack_push(&e->stack, data_new_int((int64_t)val.as.arr->size));
+			else if (val.type == DATA_MAP)
+				stack_push(&e->stack, data_new_int((int64_t)val.as.map->size));
+			else
+				return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+		} break;
+
+		case EM_CMP: {
+			data_t a, b;
+			STACK_POP_STR(e, b);
+			STACK_POP_STR(e, a);
+			stack_push(&e->stack, data_new_int(data_str_cmp(&a, &b)));
+		} break;
+
+		case EM_SLICE: {
+			data_t str, start, len;
+			STACK_POP_INT(e, len);
+			STACK_POP_INT(e, start);
+			STACK_POP_STR(e, str);
+			if (start.as.int_ < 0 || len.as.int_ < 0 ||
+			    (uint64_t)start.as.int_ + (uint64_t)len.as.int_ > str.as.str.len)
+				return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+
+			stack_push(&e->stack, data_str_slice(&e->arena, &str, (size_t)start.as.int_,
+			                                     (size_t)len.as.int_));
+		} break;
+
+		case EM_TO_STR: {
+			data_t val;
+			STACK_POP_INT(e, val);
+			stack_push(&e->stack, data_str_from_int(&e->arena, val.as.int_));
+		} break;
+
+#define STACK_POP_ARR(E, VAR) \
+	STACK_POP(e, &VAR); \
+	if (VAR.type != DATA_ARRAY) \
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, &e->prog->ems[e->ip]);
+
+		case EM_PACK: {
+			data_t size;
+			STACK_POP_INT(e, size);
+			if (size.as.int_ < 0 || (uint64_t)size.as.int_ > e->stack.size)
+				return runtime_result_err(RUNTIME_ERR_STACK_UNDERFLOW, em);
+
+			array_t *arr = array_new(&e->arena, (size_t)size.as.int_);
+			data_t  *top = e->stack.buf + e->stack.size - arr->size;
+			for (size_t i = 0; i < arr->size; ++ i) {
+				if (top[i].type != DATA_INT)
+					return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+
+				arr->buf[i] = top[i].as.int_;
+			}
+
+			stack_shrink_to(&e->stack, e->stack.size - arr->size);
+			stack_push(&e->stack, data_new_arr(arr));
+		} break;
+
+		case EM_INDEX: {
+			data_t arr, idx;
+			STACK_POP_INT(e, idx);
+			STACK_POP_ARR(e, arr);
+			if (idx.as.int_ < 0 || (uint64_t)idx.as.int_ >= arr.as.arr->size)
+				return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+
+			stack_push(&e->stack, data_new_int(arr.as.arr->buf[idx.as.int_]));
+		} break;
+
+		case EM_SUM: {
+			data_t arr;
+			STACK_POP_ARR(e, arr);
+			stack_push(&e->stack, data_new_int(array_sum(arr.as.arr->buf, arr.as.arr->size)));
+		} break;
+
+		case EM_MIN: case EM_MAX: {
+			data_t arr;
+			STACK_POP_ARR(e, arr);
+			if (arr.as.arr->size == 0)
+				return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+
+			int64_t val = em->type == EM_MIN? array_min(arr.as.arr->buf, arr.as.arr->size) :
+			                                  array_max(arr.as.arr->buf, arr.as.arr->size);
+			stack_push(&e->stack, data_new_int(val));
+		} break;
+
+		case EM_SORT: {
+			data_t arr;
+			STACK_POP_ARR(e, arr);
+
+			array_t *sorted = array_copy(&e->arena, arr.as.arr);
+			array_sort(sorted->buf, sorted->size);
+			stack_push(&e->stack, data_new_arr(sorted));
+		} break;
+
+#define STACK_POP_MAP(E, VAR) \
+	STACK_POP(e, &VAR); \
+	if (VAR.type != DATA_MAP) \
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, &e->prog->ems[e->ip]);
+
+#define STACK_POP_KEY(E, VAR) \
+	STACK_POP(e, &VAR); \
+	if (VAR.type != DATA_INT && VAR.type != DATA_STR) \
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, &e->prog->ems[e->ip]);
+
+		case EM_MAP_NEW: stack_push(&e->stack, data_new_map(map_new(&e->arena))); break;
+
+		/* Maps can not hold maps or channels, so they can never contain themselves */
+		case EM_MAP_PUT: {
+			data_t map, key, val;
+			STACK_POP(e, &val);
+			STACK_POP_KEY(e, key);
+			STACK_POP_MAP(e, map);
+			if (val.type == DATA_MAP || val.type == DATA_CHAN)
+				return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+
+			map_put(&e->arena, map.as.map, &key, &val);
+			stack_push(&e->stack, map);
+		} break;
+
+		case EM_MAP_GET: case EM_MAP_HAS: {
+			data_t map, key;
+			STACK_POP_KEY(e, key);
+			STACK_POP_MAP(e, map);
+
+			data_t *val = map_get(map.as.map, &key);
+			if (em->type == EM_MAP_HAS)
+				stack_push(&e->stack, data_new_int(val != NULL));
+			else if (val == NULL)
+				return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+			else
+				stack_push(&e->stack, *val);
+		} break;
+
+		case EM_MAP_DEL: {
+			data_t map, key;
+			STACK_POP_KEY(e, key);
+			STACK_POP_MAP(e, map);
+			map_del(map.as.map, &key);
+			stack_push(&e->stack, map);
+		} break;
+
+		case EM_YIELD:
+			if (e->ready.head != TASK_NONE)
+				TASK_SWITCH(env_task_yield(e, em));
+			break;
+
+#define STACK_POP_CHAN(E, VAR) \
+	STACK_POP(e, &VAR); \
+	PRINT_FROM_CLAMP(e); \
+	if (VAR.type != DATA_CHAN) \
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, &e->prog->ems[e->ip]);
+
+		case EM_CHAN_NEW: {
+			data_t cap;
+			STACK_POP_INT(e, cap);
+			if (cap.as.int_ < 0)
+				return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+
+			stack_push(&e->stack, data_new_chan(chan_new(&e->arena, (size_t)cap.as.int_)));
+		} break;
+
+		/* Channels can not be sent over channels either. A waiting receiver gets the value on its
+		   stack right away and is ready to run again */
+		case EM_SEND: {
+			data_t chan, val;
+			STACK_POP(e, &val);
+			STACK_POP_CHAN(e, chan);
+			if (val.type == DATA_CHAN)
+				return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+
+			chan_t *c  = env_chan(e, &chan);
+			size_t  id = task_queue_pop(e->tasks, &c->receivers);
+			if (id != TASK_NONE) {
+				task_t *t = &e->tasks[id];
+				e->tasks_mem -= env_task_mem(t);
+				stack_push(&t->stack, val);
+				e->tasks_mem += env_task_mem(t);
+				env_task_wake(e, id);
+			} else if (!chan_push(c, val))
+				TASK_SWITCH(env_task_block(e, &c->senders, val, em));
+		} break;
+
+		case EM_RECV: {
+			data_t chan, val;
+			STACK_POP_CHAN(e, chan);
+
+			chan_t *c  = env_chan(e, &chan);
+			size_t  id = task_queue_pop(e->tasks, &c->senders);
+			if (chan_pop(c, &val)) {
+				stack_push(&e->stack, val);
+				if (id != TASK_NONE) {
+					chan_push(c, e->tasks[id].val);
+					env_task_wake(e, id);
+				}
+			} else if (id != TASK_NONE) {
+				stack_push(&e->stack, e->tasks[id].val);
+				env_task_wake(e, id);
+			} else
+				TASK_SWITCH(env_task_block(e, &c->receivers, data_new_int(0), em));
+		} break;
+
+		/* Reads push the value and 1, or only 0 at the end of the input */
+		case EM_READ_INT: {
+			reader_t *in = env_input(e);
+			int64_t   val;
+			reader_status_t status = in == NULL? READER_EOF : reader_int(in, &val);
+			if (status == READER_INVALID)
+				return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+			else if (status == READER_OK)
+				stack_push(&e->stack, data_new_int(val));
+
+			stack_push(&e->stack, data_new_int(status == READER_OK));
+		} break;
+
+		case EM_READ_TOKEN: case EM_READ_LINE: {
+			reader_t   *in = env_input(e);
+			const char *text;
+			size_t      len;
+			reader_status_t status = READER_EOF;
+			if (in != NULL)
+				status = em->type == EM_READ_LINE? reader_line(in, &text, &len) :
+				                                   reader_token(in, &text, &len);
+
+			if (status == READER_OK)
+				stack_push(&e->stack, env_new_str(e, text, len));
+
+			stack_push(&e->stack, data_new_int(status == READER_OK));
+		} break;
+
+		case EM_OPEN: {
+			data_t path;
+			STACK_POP_STR(e, path);
+
+			char *cpath = (char*)malloc(path.as.str.len + 1);
+			assert(cpath != NULL);
+			memcpy(cpath, path.as.str.ptr->buf, path.as.str.len);
+			cpath[path.as.str.len] = '\0';
+
+			reader_t *in = reader_open(cpath, e->dir);
+			free(cpath);
+			if (in != NULL) {
+				if (e->in != NULL)
+					reader_destroy(e->in);
+
+				e->in = in;
+			}
+
+			stack_push(&e->stack, data_new_int(in != NULL));
+		} break;
+
 #ifdef DEBUG
 		case EM_DEBUG: {
 			for (size_t i = 0; i < e->stack.size; ++ i) {
-				fprintf(stdout, "stack[%zu]: ", i);
-				data_fprintf(&e->stack.buf[i], stdout);
-				fputc('\n', stdout);
+				fprintf(e->out, "stack[%zu]: ", i);
+				data_fprintf(&e->stack.buf[i], e->out);
+				fputc('\n', e->out);
 			}
 		} break;
 #endif
@@ -198,11 +1042,234 @@ runtime_result_t env_run(env_t *e, program_t *prog) {
 		}
 
 		++ e->tick;
-		if (e->tick % GC_FREQUENCY_IN_TICKS == 0)
-			stack_gc(&e->stack);
+		if (e->tick % GC_FREQUENCY_IN_TICKS == 0) {
+			env_gc(e);
+			if (e->checkpoint != NULL)
+				checkpoint_tick(e->checkpoint, e);
+		}
+
+		if (e->tick % TASK_SLICE_IN_TICKS == 0 && e->ready.head != TASK_NONE)
+			TASK_SWITCH(env_task_yield(e, em));
 	}
 
-	stack_clear(&e->stack);
-	env_gc(e);
 	return runtime_result_ok(e->ex);
 }
+
+#undef TASK_SWITCH
+
+static runtime_result_t env_exec_plain(env_t *e, size_t end) {
+	return env_exec_loop(e, end, false);
+}
+
+static runtime_result_t env_exec_instrumented(env_t *e, size_t end) {
+	return env_exec_loop(e, end, true);
+}
+
+static runtime_result_t env_exec_until(env_t *e, size_t end) {
+	return e->stats != NULL || e->profile != NULL? env_exec_instrumented(e, end) :
+	                                               env_exec_plain(e, end);
+}
+
+runtime_result_t env_exec(env_t *e) {
+	env_reserve_vars(e, e->prog->vars);
+	e->limited = e->limits.ticks > 0 || e->limits.stack > 0 || e->limits.mem > 0;
+
+	/* Errors and exits stop every task */
+	runtime_result_t result = env_exec_until(e, e->prog->size);
+	if (result.err != RUNTIME_OK || e->halt)
+		env_tasks_reset(e);
+
+	return result;
+}
+
+typedef struct {
+	env_t *parent;
+	em_t  *em;
+
+	data_t *inputs;
+	size_t  inputs_count;
+
+	size_t ticks, mem; /* Limits of every worker */
+
+	env_t           **workers;
+	runtime_result_t *results;
+	stats_t          *stats; /* One per worker if the parent collects stats, NULL otherwise */
+} spawn_t;
+
+/* A share of what is left of a limit, never 0 since that would mean no limit */
+static size_t env_spawn_share(size_t limit, size_t used, size_t count) {
+	size_t share = used < limit? (limit - used) / count : 0;
+	return share > 0? share : 1;
+}
+
+static void env_spawn_job(void *arg, size_t idx) {
+	spawn_t *s = (spawn_t*)arg;
+
+	env_t *w = env_new(DEFAULT_STACK_CAP);
+	w->no_stdin = true;
+	w->out      = s->parent->out;
+	w->err      = s->parent->err;
+	w->dir      = s->parent->dir;
+	env_load(w, s->parent->prog);
+
+	if (s->stats != NULL) {
+		ZERO_STRUCT(&s->stats[idx]);
+		w->stats = &s->stats[idx];
+	}
+
+	/* The workers split what is left of the ticks and the memory of the parent */
+	w->limits  = s->parent->limits;
+	w->limited = s->parent->limited;
+	if (w->limits.ticks > 0)
+		w->limits.ticks = s->ticks;
+	if (w->limits.mem > 0)
+		w->limits.mem = s->mem;
+
+	/* Workers start with copies of the variables, what they store is not seen by the parent */
+	env_reserve_vars(w, s->parent->prog->vars);
+	for (size_t i = 0; i < s->parent->prog->vars; ++ i)
+		w->vars[i] = data_copy(&w->arena, &s->parent->vars[i]);
+
+	/* Copy the inputs into the worker's own arena, so that appending to a string in place never
+	   touches memory shared with other workers */
+	for (size_t i = 0; i < s->inputs_count; ++ i)
+		stack_push(&w->stack, data_copy(&w->arena, &s->inputs[i]));
+
+	stack_push(&w->stack, data_new_int((int64_t)idx));
+
+	w->ip = (size_t)(s->em - s->parent->prog->ems) + 1;
+	s->results[idx] = env_exec_until(w, s->em->ref);
+	s->workers[idx] = w;
+}
+
+/* Runs the body of a spawn block once per worker in parallel, every worker gets its own env with
+   a copy of the inputs and its index on top. The stacks of the workers are then pushed back in
+   order of the workers */
+static runtime_result_t env_spawn(env_t *e, em_t *em) {
+	data_t count, inputs_count;
+	STACK_POP(e, &count);
+	STACK_POP(e, &inputs_count);
+	if (count.type != DATA_INT || inputs_count.type != DATA_INT)
+		return runtime_result_err(RUNTIME_ERR_INCORRECT_TYPE, em);
+	else if (count.as.int_ < 0 || inputs_count.as.int_ < 0)
+		return runtime_result_err(RUNTIME_ERR_INVALID_ACCESS, em);
+	else if ((uint64_t)inputs_count.as.int_ > e->stack.size)
+		return runtime_result_err(RUNTIME_ERR_STACK_UNDERFLOW, em);
+
+	spawn_t s = {
+		.parent       = e,
+		.em           = em,
+		.inputs_count = (size_t)inputs_count.as.int_,
+	};
+	s.inputs  = e->stack.buf + e->stack.size - s.inputs_count;
+	if (count.as.int_ > 0) {
+		s.ticks = env_spawn_share(e->limits.ticks, e->tick,    (size_t)count.as.int_);
+		s.mem   = env_spawn_share(e->limits.mem,   env_mem(e), (size_t)count.as.int_);
+	}
+	s.workers = (env_t**)malloc((size_t)count.as.int_ * sizeof(env_t*));
+	s.results = (runtime_result_t*)malloc((size_t)count.as.int_ * sizeof(runtime_result_t));
+	assert(s.workers != NULL && s.results != NULL);
+
+	if (e->stats != NULL) {
+		s.stats = (stats_t*)malloc((size_t)count.as.int_ * sizeof(stats_t));
+		assert(s.stats != NULL);
+	}
+
+	pool_run(env_spawn_job, &s, (size_t)count.as.int_);
+	stack_shrink_to(&e->stack, e->stack.size - s.inputs_count);
+
+	/* The first worker that failed or exited decides for the parent */
+	runtime_result_t result = runtime_result_ok(0);
+	for (size_t i = 0; i < (size_t)count.as.int_; ++ i) {
+		env_t *w = s.workers[i];
+		e->tick += w->tick;
+		if (s.stats != NULL)
+			stats_add(e->stats, &s.stats[i]);
+
+		if (result.err == RUNTIME_OK && !e->halt) {
+			result = s.results[i];
+			if (result.err == RUNTIME_OK && w->halt) {
+				e->halt = true;
+				e->ex   = w->ex;
+			}
+
+			for (size_t j = 0; j < w->stack.size && result.err == RUNTIME_OK && !e->halt; ++ j)
+				stack_push(&e->stack, data_copy(&e->arena, &w->stack.buf[j]));
+		}
+
+		env_destroy(w);
+	}
+
+	free(s.workers);
+	free(s.results);
+	free(s.stats);
+
+	/* What the workers ran counts towards the limits of the parent */
+	if (result.err == RUNTIME_OK && e->limited) {
+		runtime_err_t err = env_check_limits(e);
+		if (err != RUNTIME_OK)
+			result = runtime_result_err(err, em);
+	}
+
+	e->ip = em->ref;
+	return result;
+}
+
+runtime_result_t env_run(env_t *e, program_t *prog) {
+	env_load(e, prog);
+
+	runtime_result_t result = env_exec(e);
+	if (result.err != RUNTIME_OK)
+		return result;
+
+	env_unload(e);
+	return result;
+}
+
+static void env_own_literal(env_t *e, data_t *data) {
+	if (data->type == DATA_STR && data->as.str.ptr->lit)
+		*data = env_new_str(e, data->as.str.ptr->buf, data->as.str.len);
+}
+
+/* Maps and channels can not contain maps or channels, but channels can contain maps */
+static void env_own_literals_in(env_t *e, data_t *data) {
+	if (data->type == DATA_CHAN) {
+		chan_t *chan = data->as.chan;
+		for (size_t i = 0; i < chan->size; ++ i)
+			env_own_literals_in(e, &chan->buf[(chan->head + i) % chan->cap]);
+
+		return;
+	} else if (data->type != DATA_MAP) {
+		env_own_literal(e, data);
+		return;
+	}
+
+	/* Copies keep the same contents, so the hashes stay valid */
+	size_t      it = 0;
+	map_slot_t *slot;
+	while ((slot = map_next(data->as.map, &it)) != NULL) {
+		env_own_literal(e, &slot->key);
+		env_own_literal(e, &slot->val);
+	}
+}
+
+static void env_own_literals_on(env_t *e, stack_t *stack) {
+	for (size_t i = 0; i < stack->size; ++ i)
+		env_own_literals_in(e, &stack->buf[i]);
+}
+
+void env_own_literals(env_t *e) {
+	env_own_literals_on(e, &e->stack);
+	for (size_t i = 0; i < e->vars_cap; ++ i)
+		env_own_literals_in(e, &e->vars[i]);
+
+	for (size_t i = 0; i < e->tasks_size; ++ i) {
+		task_t *t = &e->tasks[i];
+		if (i == e->task || t->state == TASK_FREE)
+			continue;
+
+		env_own_literals_on(e, &t->stack);
+		if (t->state == TASK_BLOCKED)
+			env_own_literals_in(e, &t->val);
+	}
+}
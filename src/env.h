@@ -6,15 +6,38 @@
 #include <stdint.h>  /* int64_t */
 #include <stdio.h>   /* fputc, fflush */
 #include <stdbool.h> /* bool, true, false */
+#include <unistd.h>  /* STDIN_FILENO */
 
 #include "em.h"
 #include "utils.h"
 #include "stack.h"
+#include "arena.h"
+#include "map.h"
+#include "task.h"
+#include "pool.h"
+#include "reader.h"
+#include "stats.h"
+#include "profile.h"
 
 #ifndef GC_FREQUENCY_IN_TICKS
 #	define GC_FREQUENCY_IN_TICKS 64
 #endif
 
+/* The arena is only checked for garbage once it grows past this many bytes */
+#ifndef GC_MIN_THRESHOLD
+#	define GC_MIN_THRESHOLD (256 * 1024)
+#endif
+
+/* How deep subroutine calls can nest */
+#ifndef MAX_CALL_DEPTH
+#	define MAX_CALL_DEPTH 65536
+#endif
+
+/* How many instructions a task runs before it has to let the next ready task run */
+#ifndef TASK_SLICE_IN_TICKS
+#	define TASK_SLICE_IN_TICKS 1024
+#endif
+
 typedef enum {
 	RUNTIME_OK = 0,
 
@@ -22,10 +45,17 @@ typedef enum {
 	RUNTIME_ERR_INVALID_ACCESS,
 	RUNTIME_ERR_DIV_BY_ZERO,
 	RUNTIME_ERR_INCORRECT_TYPE,
+	RUNTIME_ERR_CALL_STACK_OVERFLOW,
+	RUNTIME_ERR_DEADLOCK,
+	RUNTIME_ERR_TICK_LIMIT,
+	RUNTIME_ERR_STACK_LIMIT,
+	RUNTIME_ERR_MEM_LIMIT,
 
 	RUNTIME_ERRS_COUNT,
 } runtime_err_t;
 
+typedef struct checkpoint checkpoint_t; /* In checkpoint.h */
+
 const char *runtime_err_to_cstr(runtime_err_t err);
 
 typedef struct {
@@ -37,20 +67,80 @@ typedef struct {
 runtime_result_t runtime_result_ok (int64_t ex);
 runtime_result_t runtime_result_err(runtime_err_t err, em_t *em);
 
+/* What a program is allowed to use, 0 means no limit. The limits are only checked at loop
+   back-edges and calls, not when a stack grows, so straight code between two checks can go over
+   them by as much as it pushes and allocates */
+typedef struct {
+	size_t ticks; /* Instructions ran */
+	size_t stack; /* Values on the stack of a task */
+	size_t mem;   /* Bytes of the arena, the stacks and the tasks */
+} env_limits_t;
+
 typedef struct {
 	program_t *prog;
 	stack_t    stack;
 
+	arena_t arena;
+	size_t  gc_threshold;
+
+	/* Spawned workers, and envs whose program is itself read from stdin, have no input until they
+	   open a file */
+	reader_t *in;
+	int       in_fd; /* Read from until a file is opened */
+	bool      no_stdin;
+
+	FILE *out, *err;
+	int   dir; /* Directory that opened files are relative to, -1 for the working directory */
+
+	stats_t   *stats;   /* Collected only if set */
+	profile_t *profile; /* Recorded only if set, for the program the env was loaded with */
+
+	checkpoint_t *checkpoint; /* Taken only if set */
+
+	env_limits_t limits;
+	bool         limited; /* Whether any limit is set, updated by env_exec */
+
 	size_t ip, ex, tick;
 	bool   halt;
 
+	call_t *calls;
+	size_t  calls_size, calls_cap;
+
+	/* One slot per variable of the program, the parser already resolved the names to indices */
+	data_t *vars;
+	size_t  vars_cap;
+
 	bool   print;
 	size_t print_from;
+
+	/* Green tasks, which all run on the thread of the env. Task 0 is the main task. The fields
+	   above are the context of the running task, switching tasks swaps them with a task_t */
+	task_t      *tasks;
+	size_t       tasks_size, tasks_cap, task, tasks_epoch;
+	size_t       tasks_mem; /* Bytes the stacks and calls of all the task_t take */
+	task_queue_t ready, free;
+	bool         main_done;
 } env_t;
 
-env_t *env_new    (size_t stack_cap, size_t popped_cap);
+env_t *env_new    (size_t stack_cap);
 void   env_destroy(env_t *e);
 
+/* env_run runs a whole program, env_exec only continues from the current ip and keeps the stack
+   and variables, so a program that keeps growing (like in the REPL) can be ran piece by piece */
+void             env_load  (env_t *e, program_t *prog);
+runtime_result_t env_exec  (env_t *e);
+void             env_unload(env_t *e);
+
 runtime_result_t env_run(env_t *e, program_t *prog);
 
+/* Makes room for count variables, env_exec does it for the program it runs */
+void env_reserve_vars(env_t *e, size_t count);
+
+/* Copies the string literals the env points to into its arena, so the program they came from can
+   be destroyed while the env keeps running */
+void env_own_literals(env_t *e);
+
+/* Whether a task that is switched out is still running prog, which then has to be kept */
+bool env_tasks_use(env_t *e, program_t *prog);
+
 #endif
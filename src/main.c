@@ -1,18 +1,42 @@
-#include <stdio.h>  /* stderr, fprintf, printf */
-#include <stdlib.h> /* exit, EXIT_FAILURE, EXIT_SUCCESS */
-#include <string.h> /* strcmp */
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>  /* stderr, fprintf, printf, getline, fopen, fread */
+#include <stdlib.h> /* exit, strtoull, malloc, free, EXIT_FAILURE, EXIT_SUCCESS */
+#include <stdint.h> /* SIZE_MAX */
+#include <string.h> /* strcmp, strncmp */
+#include <errno.h>  /* errno */
+#include <unistd.h> /* isatty, STDIN_FILENO */
 
 #include "parser.h"
 #include "env.h"
+#include "stream.h"
+#include "serve.h"
+#include "profile.h"
+#include "opt.h"
+#include "writer.h"
+#include "checkpoint.h"
+#include "tokens.h"
+
+typedef struct {
+	double load, lex, cross_ref, run;
+} timings_t;
 
-program_t parse(const char *path) {
+/* The hash of the source and its imports is only worked out if asked for, dump and report are
+   handed to the parser */
+program_t parse(const char *path, timings_t *times, uint64_t *hash, uint32_t dump,
+                opt_report_t *report) {
 	parser_t       *p = parser_new(DEFAULT_PROGRAM_CAP);
 	parser_result_t result;
 
+	p->dump   = dump;
+	p->report = report;
+
+	double start = time_now();
 	if (parser_load_file(p, path) != 0) {
 		fprintf(stderr, "Error: Failed to open file '%s'\n", path);
 		exit(EXIT_FAILURE);
 	}
+	times->load = time_now() - start;
 
 	result = parser_parse(p);
 	if (result.err != PARSER_OK) {
@@ -21,42 +45,480 @@ program_t parse(const char *path) {
 		exit(EXIT_FAILURE);
 	}
 
+	times->lex       = p->lex_time;
+	times->cross_ref = p->cross_ref_time;
+	if (hash != NULL)
+		*hash = parser_hash(p);
+
 	parser_destroy(p);
 	return result.prog;
 }
 
+void timings_fprintf(timings_t *times, FILE *file) {
+	double total = times->load + times->lex + times->cross_ref + times->run;
+	fprintf(file, "%-14s %12s\n", "Phase", "Time (ms)");
+	fprintf(file, "  %-12s %12.3f\n", "load",      times->load      * 1000);
+	fprintf(file, "  %-12s %12.3f\n", "lex",       times->lex       * 1000);
+	fprintf(file, "  %-12s %12.3f\n", "cross_ref", times->cross_ref * 1000);
+	fprintf(file, "  %-12s %12.3f\n", "run",       times->run       * 1000);
+	fprintf(file, "  %-12s %12.3f\n", "total",     total            * 1000);
+}
+
+/* One line per token, "ROW COL LEN KIND WHAT", where WHAT is the instruction of a keyword or the
+   error of an error */
+int print_tokens(const char *path) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL) {
+		fprintf(stderr, "Error: Failed to open file '%s'\n", path);
+		return EXIT_FAILURE;
+	}
+
+	fseek(file, 0, SEEK_END);
+	size_t size = (size_t)ftell(file);
+	rewind(file);
+
+	char *text = (char*)malloc(size + 1);
+	assert(text != NULL);
+	if (size > 0)
+		assert(fread(text, size, 1, file) > 0);
+
+	fclose(file);
+
+	tokens_t t;
+	tokens_init(&t);
+	tokens_edit(&t, 0, 0, text, size);
+
+	for (size_t i = 0; i < t.count; ++ i) {
+		for (size_t j = 0; j < t.lines[i].count; ++ j) {
+			token_t *tok = &t.lines[i].toks[j];
+			printf("%zu %zu %zu %s ", i + 1, tok->off + 1, tok->len, token_kind_to_cstr(tok->kind));
+			if (tok->kind == TOKEN_ERR)
+				printf("%s\n", parser_err_to_cstr(tok->err));
+			else if (tok->kind == TOKEN_KEYWORD)
+				printf("%s\n", em_type_to_cstr(tok->type));
+			else
+				printf("-\n");
+		}
+	}
+
+	tokens_destroy(&t);
+	free(text);
+	return EXIT_SUCCESS;
+}
+
+/* The limits hold for the whole session */
+int repl(env_limits_t limits) {
+	parser_t *p = parser_new(DEFAULT_PROGRAM_CAP);
+	p->path     = "<repl>";
+
+	env_t *e  = env_new(DEFAULT_STACK_CAP);
+	e->limits = limits;
+	env_load(e, &p->prog);
+
+	bool   tty  = isatty(STDIN_FILENO);
+	char  *line = NULL;
+	size_t cap  = 0;
+	while (!e->halt) {
+		if (tty) {
+			printf(p->pending < p->prog.size? "... " : "> ");
+			fflush(stdout);
+		}
+
+		if (getline(&line, &cap, stdin) == -1)
+			break;
+
+		parser_load_mem(p, line);
+		parser_result_t parsed = parser_parse_more(p);
+		if (parsed.err == PARSER_ERR_EXPECTED_END)
+			continue;
+		else if (parsed.err != PARSER_OK) {
+			fprintf(stderr, "Error at %s:%zu:%zu: %s\n",
+			        parsed.path, parsed.row, parsed.col, parser_err_to_cstr(parsed.err));
+			continue;
+		}
+
+		/* The program may have been reallocated while parsing */
+		e->prog = &p->prog;
+
+		runtime_result_t result = env_exec(e);
+		if (result.err != RUNTIME_OK) {
+			location_t loc = program_locate(&p->prog, result.em);
+			fprintf(stderr, "Error at %s:%zu:%zu: %s\n",
+			        loc.path, loc.row, loc.col, runtime_err_to_cstr(result.err));
+
+			/* Skip the rest of the failed input, but keep the stack */
+			e->ip         = p->prog.size;
+			e->print      = false;
+			e->calls_size = 0;
+		}
+	}
+
+	if (tty && !e->halt)
+		putchar('\n');
+
+	int ex = e->ex;
+	free(line);
+	parser_discard_pending(p);
+	env_unload(e);
+	env_destroy(e);
+	program_destroy(&p->prog);
+	parser_destroy(p);
+	return ex;
+}
+
 void usage(const char *path) {
 	printf(":O emlang :)\n"
 	       "https://github.com/lordoftrident/emlang\n\n"
-	       "Usage: %s FILE | OPTIONS\n"
+	       "Usage: %s [OPTIONS] FILE | OPTIONS\n"
 	       "Options:\n"
-	       "  -h, --help    Show the usage\n", path);
+	       "  -h, --help             Show the usage\n"
+	       "  -r, --repl             Start an interactive session\n"
+	       "  -s, --stream           Run a program from stdin while it is being read\n"
+	       "  --stats[=json]         Print execution statistics into stderr at exit\n"
+	       "  --time                 Print phase timings and allocations into stderr at exit\n"
+	       "  --serve SOCKET         Run the programs that clients send to a Unix domain socket\n"
+	       "  --client SOCKET        Run FILE on the server at SOCKET, - reads the program\n"
+	       "                         from stdin\n"
+	       "  --max-ticks N          Stop the program after it ran N instructions\n"
+	       "  --max-stack N          Stop the program once a stack holds more than N values\n"
+	       "  --max-mem BYTES        Stop the program once it uses more than BYTES, which\n"
+	       "                         can end with K, M or G\n"
+	       "  --record-profile FILE  Write how often every instruction ran into FILE at exit\n"
+	       "  --use-profile FILE     Optimize the program with a profile written by\n"
+	       "                         --record-profile\n"
+	       "  --async-output         Write the output on a thread of its own, so a slow reader\n"
+	       "                         does not stall\n"
+	       "  --checkpoint-every N   Save the state of the program every N instructions, needs\n"
+	       "                         --checkpoint-file\n"
+	       "  --checkpoint-file FILE Save the state of the program into FILE\n"
+	       "  --resume FILE          Continue the program from a state saved by --checkpoint-file\n"
+	       "  --dump-ir=STAGE        Print the instructions into stderr after STAGE, which is\n"
+	       "                         lex, cross-ref, link, unroll, fuse, hot or all\n"
+	       "  --opt-report           Print what the optimizations did to every part of the\n"
+	       "                         program into stderr\n"
+	       "  --tokens               Print the tokens of FILE one per line instead of running it\n",
+	       path);
+}
+
+/* Only a byte count can have a suffix */
+bool parse_limit(const char *str, bool suffix, size_t *ret) {
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(str, &end, 10);
+	if (end == str || *str == '-' || errno != 0)
+		return false;
+
+	int shift = 0;
+	if (suffix && *end != '\0') {
+		switch (*end ++) {
+		case 'K': shift = 10; break;
+		case 'M': shift = 20; break;
+		case 'G': shift = 30; break;
+		default:  return false;
+		}
+	}
+
+	if (*end != '\0' || n > (SIZE_MAX >> shift))
+		return false;
+
+	*ret = (size_t)n << shift;
+	return true;
 }
 
 int main(int argc, const char **argv) {
-	if (argc != 2) {
+	const char *path = NULL, *client = NULL, *serve = NULL, *record = NULL, *use = NULL;
+	const char *checkpoint_path = NULL, *resume = NULL;
+	size_t      checkpoint_every = 0;
+
+	bool           stats  = false, timing = false, interactive = false, stream = false;
+	bool           async  = false, report = false, tokens = false;
+	uint32_t       dump   = 0;
+	stats_format_t format = STATS_TEXT;
+	env_limits_t   limits = {0};
+	for (int i = 1; i < argc; ++ i) {
+		const char *arg = argv[i];
+		if (strcmp(arg, "-h") == 0 || strcmp(arg, "--help") == 0) {
+			usage(argv[0]);
+			return EXIT_SUCCESS;
+		} else if (strcmp(arg, "-r") == 0 || strcmp(arg, "--repl") == 0)
+			interactive = true;
+		else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--stream") == 0)
+			stream = true;
+		else if (strcmp(arg, "--serve") == 0 || strcmp(arg, "--client") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Error: Option '%s' expects a socket path\n", arg);
+				return EXIT_FAILURE;
+			} else if (strcmp(arg, "--serve") == 0)
+				serve = argv[++ i];
+			else
+				client = argv[++ i];
+		} else if (strcmp(arg, "--record-profile") == 0 || strcmp(arg, "--use-profile") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Error: Option '%s' expects a file path\n", arg);
+				return EXIT_FAILURE;
+			} else if (strcmp(arg, "--record-profile") == 0)
+				record = argv[++ i];
+			else
+				use = argv[++ i];
+		} else if (strcmp(arg, "--checkpoint-file") == 0 || strcmp(arg, "--resume") == 0) {
+			if (i + 1 >= argc) {
+				fprintf(stderr, "Error: Option '%s' expects a file path\n", arg);
+				return EXIT_FAILURE;
+			} else if (strcmp(arg, "--resume") == 0)
+				resume = argv[++ i];
+			else
+				checkpoint_path = argv[++ i];
+		} else if (strcmp(arg, "--checkpoint-every") == 0) {
+			if (i + 1 >= argc || !parse_limit(argv[i + 1], false, &checkpoint_every) ||
+			    checkpoint_every == 0) {
+				fprintf(stderr, "Error: Option '%s' expects a number above 0\n", arg);
+				return EXIT_FAILURE;
+			}
+
+			++ i;
+		} else if (strcmp(arg, "--max-ticks") == 0 || strcmp(arg, "--max-stack") == 0 ||
+		           strcmp(arg, "--max-mem") == 0) {
+			size_t *limit = &limits.mem;
+			if (strcmp(arg, "--max-ticks") == 0)
+				limit = &limits.ticks;
+			else if (strcmp(arg, "--max-stack") == 0)
+				limit = &limits.stack;
+
+			if (i + 1 >= argc || !parse_limit(argv[i + 1], limit == &limits.mem, limit)) {
+				fprintf(stderr, "Error: Option '%s' expects a number\n", arg);
+				return EXIT_FAILURE;
+			}
+
+			++ i;
+		} else if (strncmp(arg, "--dump-ir=", 10) == 0) {
+			parser_stage_t stage = parser_stage_from_cstr(arg + 10);
+			if (strcmp(arg + 10, "all") == 0)
+				dump = (1u << PARSER_STAGES_COUNT) - 1;
+			else if (stage == PARSER_STAGES_COUNT) {
+				fprintf(stderr, "Error: Unknown stage '%s'\n", arg + 10);
+				return EXIT_FAILURE;
+			} else
+				dump |= 1u << stage;
+		} else if (strcmp(arg, "--opt-report") == 0)
+			report = true;
+		else if (strcmp(arg, "--tokens") == 0)
+			tokens = true;
+		else if (strcmp(arg, "--async-output") == 0)
+			async = true;
+		else if (strcmp(arg, "--time") == 0)
+			timing = true;
+		else if (strcmp(arg, "--stats") == 0)
+			stats = true;
+		else if (strcmp(arg, "--stats=json") == 0) {
+			stats  = true;
+			format = STATS_JSON;
+		} else if (arg[0] == '-' && strcmp(arg, "-") != 0) {
+			fprintf(stderr, "Error: Unknown option '%s'\n", arg);
+			fprintf(stderr, "Try '%s -h'\n", argv[0]);
+			return EXIT_FAILURE;
+		} else if (path != NULL) {
+			fprintf(stderr, "Error: More than one file provided\n");
+			return EXIT_FAILURE;
+		} else
+			path = arg;
+	}
+
+	/* A profile is of one program ran as a whole, and a program ran with one is not the same as the
+	   one it was recorded from */
+	if ((record != NULL || use != NULL) &&
+	    (interactive || stream || serve != NULL || client != NULL)) {
+		fprintf(stderr, "Error: Profiles can only be used when running a file\n");
+		return EXIT_FAILURE;
+	} else if ((dump != 0 || report || tokens) &&
+	           (interactive || stream || serve != NULL || client != NULL)) {
+		fprintf(stderr, "Error: '--dump-ir', '--opt-report' and '--tokens' only work on a file\n");
+		return EXIT_FAILURE;
+	} else if (async && (interactive || stream || serve != NULL || client != NULL)) {
+		fprintf(stderr, "Error: '--async-output' can only be used when running a file\n");
+		return EXIT_FAILURE;
+	} else if ((checkpoint_path != NULL || resume != NULL) &&
+	           (interactive || stream || serve != NULL || client != NULL)) {
+		fprintf(stderr, "Error: Checkpoints can only be used when running a file\n");
+		return EXIT_FAILURE;
+	} else if ((checkpoint_path != NULL) != (checkpoint_every > 0)) {
+		fprintf(stderr, "Error: '--checkpoint-every' and '--checkpoint-file' go together\n");
+		return EXIT_FAILURE;
+	} else if (record != NULL && use != NULL) {
+		fprintf(stderr, "Error: '--record-profile' can not be used with '--use-profile'\n");
+		return EXIT_FAILURE;
+	}
+
+	/* Limits are read before any of these start, wherever they were on the command line */
+	if (interactive)
+		return repl(limits);
+	else if (stream)
+		return stream_run(STDIN_FILENO, "<stdin>", limits);
+	else if (serve != NULL)
+		return serve_run(serve, limits);
+
+	if (path == NULL) {
 		fprintf(stderr, "Error: No file provided\n");
 		fprintf(stderr, "Try '%s -h'\n", argv[0]);
 		return EXIT_FAILURE;
-	} else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
-		usage(argv[0]);
-		return EXIT_SUCCESS;
 	}
 
-	program_t prog = parse(argv[1]);
+	if (tokens)
+		return print_tokens(path);
+
+	if (client != NULL) {
+		if (timing) {
+			fprintf(stderr, "Error: '--time' can not be used with '--client'\n");
+			return EXIT_FAILURE;
+		} else if (limits.ticks > 0 || limits.stack > 0 || limits.mem > 0) {
+			fprintf(stderr, "Error: The limits of the server apply with '--client'\n");
+			return EXIT_FAILURE;
+		}
+
+		uint32_t flags = 0;
+		if (stats)
+			flags |= format == STATS_JSON? SERVE_STATS | SERVE_STATS_JSON : SERVE_STATS;
+
+		return serve_client(client, path, flags);
+	}
+
+	opt_report_t remarks;
+	if (report)
+		opt_report_init(&remarks);
+
+	timings_t times = {0};
+	uint64_t  hash  = 0;
+	bool      keyed = record != NULL || use != NULL || checkpoint_path != NULL || resume != NULL;
+	program_t prog  = parse(path, &times, keyed? &hash : NULL, dump, report? &remarks : NULL);
+
+	/* A stale profile is only a missed optimization */
+	profile_t profile;
+	size_t    stack_cap = DEFAULT_STACK_CAP;
+	if (record != NULL)
+		profile_init(&profile, prog.size, hash);
+	else if (use != NULL) {
+		profile_err_t err = profile_load(&profile, &prog, use, hash);
+		if (err != PROFILE_OK)
+			fprintf(stderr, "Warning: Ignoring profile '%s': %s\n", use, profile_err_to_cstr(err));
+		else {
+			opt_fuse_hot(&prog, &profile, report? &remarks : NULL);
+			if (profile.stack_high > stack_cap)
+				stack_cap = profile.stack_high;
+
+			profile_destroy(&profile);
+		}
+	}
+
+	if (dump & (1u << PARSER_STAGE_HOT)) {
+		fprintf(stderr, "ir %s\n", parser_stage_to_cstr(PARSER_STAGE_HOT));
+		program_fprintf(&prog, stderr);
+	}
+
+	/* Everything the passes had to say comes before the output of the program */
+	if (report) {
+		opt_report_fprintf(&remarks, prog.src, stderr);
+		opt_report_destroy(&remarks);
+	}
 
 #ifdef DEBUG
 	for (size_t i = 0; i < prog.size; ++ i)
-		em_fprintf(&prog.ems[i], stdout);
+		em_fprintf(&prog, &prog.ems[i], stdout);
 #endif
 
-	env_t *e = env_new(DEFAULT_STACK_CAP, DEFAULT_POPPED_CAP);
+	env_t *e  = env_new(stack_cap);
+	e->limits = limits;
+	if (record != NULL)
+		e->profile = &profile;
+
+	/* Whatever was printed before has to come out first */
+	writer_t *writer = NULL;
+	if (async) {
+		fflush(stdout);
+		fflush(stderr);
+
+		writer = writer_new(STDOUT_FILENO, STDERR_FILENO);
+		if (writer == NULL) {
+			fprintf(stderr, "Error: Failed to start the output thread\n");
+			return EXIT_FAILURE;
+		}
+
+		e->out = writer->out;
+		e->err = writer->err;
+	}
+
+	stats_t st;
+	if (stats) {
+		stats_init(&st);
+		e->stats = &st;
+		stats_perf_start(&st);
+	}
+
+	checkpoint_t checkpoint;
+	if (checkpoint_path != NULL) {
+		checkpoint_init(&checkpoint, checkpoint_path, checkpoint_every, hash);
+		e->checkpoint = &checkpoint;
+	}
+
+	double start = time_now();
+	runtime_result_t result;
+	if (resume != NULL) {
+		/* Same as env_run, but from where the checkpoint left off */
+		env_load(e, &prog);
+
+		checkpoint_err_t err = checkpoint_load(e, resume, hash);
+		if (err != CHECKPOINT_OK) {
+			fprintf(stderr, "Error: Failed to resume from '%s': %s\n",
+			        resume, checkpoint_err_to_cstr(err));
+			exit(EXIT_FAILURE);
+		}
+
+		result = env_exec(e);
+		if (result.err == RUNTIME_OK)
+			env_unload(e);
+	} else
+		result = env_run(e, &prog);
+	times.run = time_now() - start;
+
+	if (checkpoint_path != NULL)
+		checkpoint_finish(&checkpoint);
+
+	/* Exits, errors and normal ends all get here, the errors are reported after the output */
+	if (writer != NULL)
+		writer_destroy(writer);
+
+	/* Failed runs are recorded too */
+	if (record != NULL) {
+		profile.stack_high = e->stack.high;
+
+		profile_err_t err = profile_save(&profile, &prog, record);
+		if (err != PROFILE_OK)
+			fprintf(stderr, "Error: Failed to write the profile '%s'\n", record);
+
+		profile_destroy(&profile);
+	}
+
+	if (stats) {
+		stats_perf_stop(&st);
+		st.ticks          = e->tick;
+		st.stack_high     = e->stack.high;
+		st.stack_reallocs = e->stack.reallocs;
+
+		fflush(stdout);
+		stats_fprintf(&st, format, stderr);
+		stats_destroy(&st);
+	}
+
+	if (timing) {
+		fflush(stdout);
+		timings_fprintf(&times, stderr);
+
+		alloc_stats_t allocs = alloc_stats();
+		alloc_stats_fprintf(&allocs, stderr);
+	}
 
-	runtime_result_t result = env_run(e, &prog);
 	if (result.err != RUNTIME_OK) {
+		location_t loc = program_locate(&prog, result.em);
 		fprintf(stderr, "Error at %s:%zu:%zu: %s\n",
-		        result.em->path, result.em->row, result.em->col,
-		        runtime_err_to_cstr(result.err));
+		        loc.path, loc.row, loc.col, runtime_err_to_cstr(result.err));
 		exit(EXIT_FAILURE);
 	}
 
@@ -0,0 +1,196 @@
+#include "map.h"
+
+/* SSE2 is always there on x86_64, anything else matches the control bytes one by one */
+#if defined(__GNUC__) && defined(__SSE2__)
+#	define MAP_SSE2
+#	include <emmintrin.h>
+#endif
+
+#define MAP_MIN_CAP 16 /* Has to be at least MAP_GROUP_SIZE */
+
+#define MAP_EMPTY   ((int8_t)-128)
+#define MAP_DELETED ((int8_t)-2)
+
+#define MAP_H1(HASH) ((size_t)((HASH) >> 7))
+#define MAP_H2(HASH) ((int8_t)((HASH) & 0x7f))
+
+static uint64_t map_hash(data_t *key) {
+	uint64_t hash = key->type == DATA_INT? (uint64_t)key->as.int_ :
+	                                       str_hash(key->as.str.ptr, key->as.str.len);
+
+	/* Finalizer of MurmurHash3, so both the probe position and the control byte get good bits */
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdULL;
+	hash ^= hash >> 33;
+	hash *= 0xc4ceb9fe1a85ec53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+static bool map_key_equ(map_slot_t *slot, data_t *key, uint64_t hash) {
+	if (slot->hash != hash || slot->key.type != key->type)
+		return false;
+	else if (key->type == DATA_INT)
+		return slot->key.as.int_ == key->as.int_;
+
+	return slot->key.as.str.len == key->as.str.len &&
+	       memcmp(slot->key.as.str.ptr->buf, key->as.str.ptr->buf, key->as.str.len) == 0;
+}
+
+/* Bit i is set if control byte i of the group equals ctrl */
+static uint32_t map_match(const int8_t *group, int8_t ctrl) {
+#ifdef MAP_SSE2
+	__m128i bytes = _mm_loadu_si128((const __m128i*)group);
+	return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(ctrl)));
+#else
+	uint32_t mask = 0;
+	for (size_t i = 0; i < MAP_GROUP_SIZE; ++ i)
+		mask |= (uint32_t)(group[i] == ctrl) << i;
+
+	return mask;
+#endif
+}
+
+/* Groups are probed at triangular offsets, which visits every group since the capacity is a power
+   of two. There is always an empty slot, so the probing stops */
+static size_t map_find(map_t *map, data_t *key, uint64_t hash) {
+	size_t mask = map->cap - 1, pos = MAP_H1(hash) & mask;
+	for (size_t step = MAP_GROUP_SIZE;; step += MAP_GROUP_SIZE) {
+		const int8_t *group = map->ctrl + pos;
+		for (uint32_t match = map_match(group, MAP_H2(hash)); match != 0; match &= match - 1) {
+			size_t i = (pos + (size_t)__builtin_ctz(match)) & mask;
+			if (map_key_equ(&map->slots[i], key, hash))
+				return i;
+		}
+
+		if (map_match(group, MAP_EMPTY) != 0)
+			return SIZE_MAX;
+
+		pos = (pos + step) & mask;
+	}
+}
+
+static size_t map_find_free(map_t *map, uint64_t hash) {
+	size_t mask = map->cap - 1, pos = MAP_H1(hash) & mask;
+	for (size_t step = MAP_GROUP_SIZE;; step += MAP_GROUP_SIZE) {
+		const int8_t *group = map->ctrl + pos;
+		uint32_t      match = map_match(group, MAP_EMPTY) | map_match(group, MAP_DELETED);
+		if (match != 0)
+			return (pos + (size_t)__builtin_ctz(match)) & mask;
+
+		pos = (pos + step) & mask;
+	}
+}
+
+static void map_set_ctrl(map_t *map, size_t i, int8_t ctrl) {
+	map->ctrl[i] = ctrl;
+	if (i < MAP_GROUP_SIZE)
+		map->ctrl[map->cap + i] = ctrl;
+}
+
+static void map_alloc(arena_t *arena, map_t *map, size_t cap) {
+	map->cap     = cap;
+	map->size    = 0;
+	map->deleted = 0;
+
+	map->ctrl  = (int8_t*)arena_alloc(arena, cap + MAP_GROUP_SIZE);
+	map->slots = (map_slot_t*)arena_alloc(arena, cap * sizeof(map_slot_t));
+	memset(map->ctrl, MAP_EMPTY, cap + MAP_GROUP_SIZE);
+}
+
+map_t *map_new(arena_t *arena) {
+	map_t *map = (map_t*)arena_alloc(arena, sizeof(map_t));
+	map_alloc(arena, map, MAP_MIN_CAP);
+	return map;
+}
+
+/* Values are copied too, but their hashes are kept */
+map_t *map_copy(arena_t *arena, map_t *map) {
+	map_t *copy = (map_t*)arena_alloc(arena, sizeof(map_t));
+	map_alloc(arena, copy, map->cap);
+	memcpy(copy->ctrl, map->ctrl, map->cap + MAP_GROUP_SIZE);
+	copy->size    = map->size;
+	copy->deleted = map->deleted;
+
+	for (size_t i = 0; i < map->cap; ++ i) {
+		if (map->ctrl[i] < 0)
+			continue;
+
+		copy->slots[i] = (map_slot_t){
+			.key  = data_copy(arena, &map->slots[i].key),
+			.val  = data_copy(arena, &map->slots[i].val),
+			.hash = map->slots[i].hash,
+		};
+	}
+
+	return copy;
+}
+
+/* Also gets rid of the deleted slots */
+static void map_rehash(arena_t *arena, map_t *map, size_t cap) {
+	map_t old = *map;
+	map_alloc(arena, map, cap);
+
+	for (size_t i = 0; i < old.cap; ++ i) {
+		if (old.ctrl[i] < 0)
+			continue;
+
+		size_t j = map_find_free(map, old.slots[i].hash);
+		map_set_ctrl(map, j, MAP_H2(old.slots[i].hash));
+		map->slots[j] = old.slots[i];
+		++ map->size;
+	}
+}
+
+void map_put(arena_t *arena, map_t *map, data_t *key, data_t *val) {
+	assert(key->type == DATA_INT || key->type == DATA_STR);
+
+	uint64_t hash = map_hash(key);
+	size_t   i    = map_find(map, key, hash);
+	if (i != SIZE_MAX) {
+		map->slots[i].val = *val;
+		return;
+	}
+
+	/* Keep the load under 7/8, if it is mostly deleted slots the table does not need to grow */
+	if ((map->size + map->deleted + 1) * 8 > map->cap * 7)
+		map_rehash(arena, map, map->size * 2 >= map->cap? map->cap * 2 : map->cap);
+
+	i = map_find_free(map, hash);
+	if (map->ctrl[i] == MAP_DELETED)
+		-- map->deleted;
+
+	map_set_ctrl(map, i, MAP_H2(hash));
+	map->slots[i] = (map_slot_t){.key = *key, .val = *val, .hash = hash};
+	++ map->size;
+}
+
+data_t *map_get(map_t *map, data_t *key) {
+	assert(key->type == DATA_INT || key->type == DATA_STR);
+
+	size_t i = map_find(map, key, map_hash(key));
+	return i == SIZE_MAX? NULL : &map->slots[i].val;
+}
+
+bool map_del(map_t *map, data_t *key) {
+	assert(key->type == DATA_INT || key->type == DATA_STR);
+
+	size_t i = map_find(map, key, map_hash(key));
+	if (i == SIZE_MAX)
+		return false;
+
+	map_set_ctrl(map, i, MAP_DELETED);
+	-- map->size;
+	++ map->deleted;
+	return true;
+}
+
+map_slot_t *map_next(map_t *map, size_t *it) {
+	while (*it < map->cap) {
+		size_t i = (*it) ++;
+		if (map->ctrl[i] >= 0)
+			return &map->slots[i];
+	}
+
+	return NULL;
+}
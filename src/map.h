@@ -0,0 +1,42 @@
+#ifndef MAP_H_HEADER_GUARD
+#define MAP_H_HEADER_GUARD
+
+#include <stdint.h>  /* int8_t, uint32_t, uint64_t, SIZE_MAX */
+#include <stdlib.h>  /* size_t */
+#include <string.h>  /* memset, memcpy, memcmp */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "arena.h"
+#include "data.h"
+
+#define MAP_GROUP_SIZE 16
+
+typedef struct {
+	data_t   key, val;
+	uint64_t hash;
+} map_slot_t;
+
+/* Swiss table style open addressing hash map from ints or strings to values. Every slot has a
+   control byte holding 7 bits of the hash of its key, or a mark for an empty or deleted slot, and
+   lookups compare a whole group of control bytes at once. Maps are changed in place and live in
+   an arena, the old table of a map that grows is left for the arena to free */
+struct map {
+	int8_t     *ctrl; /* cap + MAP_GROUP_SIZE bytes, the first group is repeated at the end */
+	map_slot_t *slots;
+	size_t      cap, size, deleted;
+};
+
+map_t *map_new (arena_t *arena);
+map_t *map_copy(arena_t *arena, map_t *map);
+
+/* Keys have to be ints or strings */
+void    map_put(arena_t *arena, map_t *map, data_t *key, data_t *val);
+data_t *map_get(map_t *map, data_t *key);
+bool    map_del(map_t *map, data_t *key);
+
+/* Iterates over the entries in no particular order, it has to start at 0. Returns NULL at the
+   end */
+map_slot_t *map_next(map_t *map, size_t *it);
+
+#endif
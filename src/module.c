@@ -0,0 +1,163 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h> /* read, close */
+#include <fcntl.h>  /* openat, O_RDONLY, AT_FDCWD */
+#include <errno.h>  /* errno, EINTR */
+
+#include "module.h"
+
+static struct {
+	pthread_mutex_t lock;
+	module_t       *head;
+} modules = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool module_same_file(module_t *m, struct stat *st) {
+	return m->dev == st->st_dev && m->ino == st->st_ino;
+}
+
+static bool module_same_version(module_t *m, struct stat *st) {
+	return m->size == st->st_size && m->mtime.tv_sec == st->st_mtim.tv_sec &&
+	       m->mtime.tv_nsec == st->st_mtim.tv_nsec;
+}
+
+static char *module_read(int fd, size_t size) {
+	char *buf = (char*)alloc_malloc(ALLOC_PARSER_INPUT, size + 1);
+	assert(buf != NULL);
+
+	size_t got = 0;
+	while (got < size) {
+		ssize_t n = read(fd, buf + got, size - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			break;
+
+		got += (size_t)n;
+	}
+
+	buf[got] = '\0';
+	return buf;
+}
+
+static void module_destroy(module_t *m) {
+	for (size_t i = 0; i < m->imports_count; ++ i)
+		alloc_free(m->imports[i].path);
+
+	alloc_free(m->imports);
+	if (m->err.err == PARSER_OK)
+		program_destroy(&m->prog);
+
+	source_release(m->src);
+	alloc_free(m->path);
+	alloc_free(m);
+}
+
+/* Errors are in the module, so they already have its path */
+static void module_lex(module_t *m, int fd) {
+	char *text = module_read(fd, (size_t)m->size);
+
+	parser_t *p = parser_new(DEFAULT_PROGRAM_CAP);
+	p->path     = m->path;
+	parser_load_mem(p, text);
+
+	parser_result_t result = parser_lex_module(p);
+	m->err = result;
+	m->src = source_ref(p->src);
+	if (result.err == PARSER_OK) {
+		m->hash = hash_bytes(text, p->len);
+		m->prog = p->prog;
+
+		m->imports       = p->imports;
+		m->imports_count = p->imports_count;
+		p->imports       = NULL;
+		p->imports_count = 0;
+	} else
+		program_destroy(&p->prog);
+
+	parser_destroy(p);
+	alloc_free(text);
+}
+
+/* The lock is held while lexing, so a module that many programs import at once is lexed once */
+parser_result_t module_get(int dir, const char *path, module_t **ret) {
+	int fd = openat(dir == -1? AT_FDCWD : dir, path, O_RDONLY);
+	if (fd == -1)
+		return (parser_result_t){.err = PARSER_ERR_IMPORT};
+
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return (parser_result_t){.err = PARSER_ERR_IMPORT};
+	}
+
+	pthread_mutex_lock(&modules.lock);
+
+	module_t **it = &modules.head;
+	for (; *it != NULL && !module_same_file(*it, &st); it = &(*it)->next);
+
+	if (*it == NULL || !module_same_version(*it, &st)) {
+		module_t *m = (module_t*)alloc_malloc(ALLOC_SOURCE, sizeof(module_t));
+		assert(m != NULL);
+		ZERO_STRUCT(m);
+
+		m->path = (char*)alloc_malloc(ALLOC_SOURCE, strlen(path) + 1);
+		assert(m->path != NULL);
+		strcpy(m->path, path);
+
+		m->dev   = st.st_dev;
+		m->ino   = st.st_ino;
+		m->mtime = st.st_mtim;
+		m->size  = st.st_size;
+
+		module_lex(m, fd);
+
+		/* The old version is dropped, parsers that still use it keep it alive */
+		if (*it != NULL) {
+			module_t *old = *it;
+			*it = old->next;
+			if (-- old->refs == 0)
+				module_destroy(old);
+		}
+
+		m->refs      = 1;
+		m->next      = modules.head;
+		modules.head = m;
+		it           = &modules.head;
+	}
+
+	parser_result_t result = (*it)->err;
+	if (result.err == PARSER_OK) {
+		++ (*it)->refs;
+		*ret = *it;
+	}
+
+	pthread_mutex_unlock(&modules.lock);
+	close(fd);
+	return result;
+}
+
+module_t *module_ref(module_t *m) {
+	pthread_mutex_lock(&modules.lock);
+	++ m->refs;
+	pthread_mutex_unlock(&modules.lock);
+	return m;
+}
+
+void module_release(module_t *m) {
+	pthread_mutex_lock(&modules.lock);
+	bool last = -- m->refs == 0;
+	pthread_mutex_unlock(&modules.lock);
+
+	if (last)
+		module_destroy(m);
+}
+
+bool module_stale(module_t *m, int dir, const char *path) {
+	struct stat st;
+	if (fstatat(dir == -1? AT_FDCWD : dir, path, &st, 0) != 0)
+		return true;
+
+	return !module_same_file(m, &st) || !module_same_version(m, &st);
+}
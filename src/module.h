@@ -0,0 +1,55 @@
+#ifndef MODULE_H_HEADER_GUARD
+#define MODULE_H_HEADER_GUARD
+
+#include <stdio.h>     /* size_t */
+#include <stdint.h>    /* uint64_t */
+#include <stdlib.h>    /* free */
+#include <string.h>    /* strlen, strcpy */
+#include <assert.h>    /* assert */
+#include <stdbool.h>   /* bool, true, false */
+#include <pthread.h>   /* pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock */
+#include <sys/types.h> /* dev_t, ino_t, off_t */
+#include <sys/stat.h>  /* struct stat, fstat, fstatat */
+
+#include "parser.h"
+
+/* A file that programs import. Every file is read and lexed at most once per process, as long as
+   it does not change: modules are cached by the device and inode of the file and lexed again only
+   once its modification time or size differ. Modules are only lexed, the variables get their slots
+   and the imports of the module are expanded when a parser imports it, since both depend on the
+   program it is imported into */
+struct module {
+	char *path; /* As the first program that imported it opened it, only for errors */
+
+	dev_t           dev;
+	ino_t           ino;
+	struct timespec mtime;
+	off_t           size;
+	uint64_t        hash; /* Of the contents */
+
+	/* Files that failed to lex are cached too, the error points into src */
+	parser_result_t err;
+
+	source_t *src;
+	program_t prog;
+
+	import_t *imports;
+	size_t    imports_count;
+
+	size_t    refs; /* One for being in the cache, and one for every parser that imported it */
+	module_t *next;
+};
+
+/* Returns the module with a reference for the caller. If the file could not be opened, the error
+   is PARSER_ERR_IMPORT without a path, for the caller to locate at the import. Errors in the
+   module itself stay valid while the module is cached */
+parser_result_t module_get    (int dir, const char *path, module_t **ret);
+module_t       *module_ref    (module_t *m);
+void            module_release(module_t *m);
+
+/* Whether the file at path, relative to dir, is no longer the file of the module or changed since
+   the module was lexed. Programs open the same module by different paths, so the path is the one
+   the caller imported it by */
+bool module_stale(module_t *m, int dir, const char *path);
+
+#endif
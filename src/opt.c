@@ -0,0 +1,329 @@
+#include "opt.h"
+
+/* Counters of unrolled loops stay far from overflowing */
+#define OPT_MAX_CONST ((int64_t)1 << 40)
+
+typedef struct {
+	size_t begin, tail, end; /* :@, the 0 of "0 :D N :<" and @: */
+	bool   step;             /* Whether the body begins with "K ;)" */
+} loop_t;
+
+static bool opt_push_int(em_t *em) {
+	return em->type == EM_PUSH && em->data.type == DATA_INT;
+}
+
+static bool opt_match_loop(program_t *prog, size_t end, loop_t *loop) {
+	em_t *ems = prog->ems;
+	loop->begin = ems[end].ref;
+	loop->end   = end;
+	if (end < loop->begin + 5)
+		return false;
+
+	loop->tail = end - 4;
+	if (!opt_push_int(&ems[loop->tail]) || ems[loop->tail].data.as.int_ != 0 ||
+	    ems[end - 3].type != EM_DUP || !opt_push_int(&ems[end - 2]))
+		return false;
+
+	switch (ems[end - 1].type) {
+	case EM_GRT: case EM_LESS: case EM_EQU: case EM_NEQU: break;
+
+	default: return false;
+	}
+
+	loop->step = loop->begin + 3 <= loop->tail && opt_push_int(&ems[loop->begin + 1]) &&
+	             ems[loop->begin + 2].type == EM_ADD;
+	return true;
+}
+
+static bool opt_cmp(em_type_t type, int64_t a, int64_t b) {
+	switch (type) {
+	case EM_GRT:  return a >  b;
+	case EM_LESS: return a <  b;
+	case EM_EQU:  return a == b;
+	case EM_NEQU: return a != b;
+
+	default: assert(0);
+	}
+}
+
+/* Whether the instructions never pop what was on the stack before them and leave the stack as
+   high as they found it. Print blocks can not pop what was there before them either */
+static bool opt_neutral(program_t *prog, size_t from, size_t to) {
+	size_t height = 0, print = SIZE_MAX;
+	for (size_t i = from; i < to; ++ i) {
+		em_t  *em = &prog->ems[i];
+		size_t pops, pushes;
+		switch (em->type) {
+		case EM_PUSH: case EM_LOAD: pops = 0; pushes = 1; break;
+		case EM_POP: case EM_STORE: case EM_EXIT: pops = 1; pushes = 0; break;
+		case EM_DUP: pops = 1; pushes = 1; break;
+
+		case EM_ADD: case EM_SUB: case EM_MUL: case EM_DIV:
+		case EM_GRT: case EM_LESS: case EM_EQU: case EM_NEQU:
+			pops   = 2;
+			pushes = 1;
+			break;
+
+		/* An empty print block prints the value before it */
+		case EM_PRINT_BEGIN:
+			if (em->ref == i + 1) {
+				pops   = 1;
+				pushes = 0;
+				++ i;
+			} else {
+				print  = height;
+				pops   = 0;
+				pushes = 0;
+			}
+			break;
+
+		case EM_PRINT_END:
+			height = print;
+			print  = SIZE_MAX;
+			continue;
+
+		default: return false;
+		}
+
+		if (pops > height || (print != SIZE_MAX && height - pops < print))
+			return false;
+
+		height += pushes - pops;
+	}
+
+	return height == 0;
+}
+
+/* How many times the loop runs, 0 if it is too many times or could not be worked out */
+static size_t opt_trips(program_t *prog, loop_t *loop) {
+	em_t *ems = prog->ems;
+	if (!loop->step || loop->begin < 2 || !opt_push_int(&ems[loop->begin - 2]) ||
+	    !opt_push_int(&ems[loop->begin - 1]) || ems[loop->begin - 1].data.as.int_ == 0)
+		return 0;
+
+	int64_t counter = ems[loop->begin - 2].data.as.int_;
+	int64_t step    = ems[loop->begin + 1].data.as.int_, bound = ems[loop->end - 2].data.as.int_;
+	if (step >= OPT_MAX_CONST || step <= -OPT_MAX_CONST)
+		return 0;
+
+	for (size_t trips = 1; trips <= OPT_UNROLL_MAX_TRIPS; ++ trips) {
+		if (counter >= OPT_MAX_CONST || counter <= -OPT_MAX_CONST)
+			return 0;
+
+		counter += step;
+		if (!opt_cmp(ems[loop->end - 1].type, counter, bound))
+			return trips;
+	}
+
+	return 0;
+}
+
+/* How many times the loop runs if it can be unrolled, 0 if not and then why is set */
+static size_t opt_unrollable(program_t *prog, size_t from, loop_t *loop, const char **why) {
+	em_t *ems = prog->ems;
+	if (!loop->step) {
+		*why = "the body does not begin with \"K ;)\"";
+		return 0;
+	} else if (loop->begin < from + 2 || !opt_push_int(&ems[loop->begin - 2]) ||
+	           !opt_push_int(&ems[loop->begin - 1]) || ems[loop->begin - 1].data.as.int_ == 0) {
+		*why = "the counter does not start at a constant";
+		return 0;
+	}
+
+	size_t trips = opt_trips(prog, loop);
+	if (trips == 0)
+		*why = "it runs too many times";
+	else if (trips * (loop->tail - loop->begin - 1) > OPT_UNROLL_MAX_EMS)
+		*why = "the unrolled body would be too long";
+	else if (!opt_neutral(prog, loop->begin + 3, loop->tail))
+		*why = "the body reaches the counter";
+	else
+		return trips;
+
+	return 0;
+}
+
+/* Loops that are not counted are reported by opt_fuse_loops */
+static void opt_report_unroll(program_t *prog, size_t from, size_t to, opt_report_t *report) {
+	for (size_t i = from; i < to; ++ i) {
+		loop_t loop;
+		if (prog->ems[i].type != EM_LOOP_END || !opt_match_loop(prog, i, &loop) ||
+		    loop.begin < from)
+			continue;
+
+		const char *why;
+		size_t      trips = opt_unrollable(prog, from, &loop, &why);
+		if (trips > 0)
+			opt_report_add(report, prog->ems[loop.begin].off, "unrolled, runs %zu times", trips);
+		else
+			opt_report_add(report, prog->ems[loop.begin].off, "not unrolled, %s", why);
+	}
+}
+
+bool opt_unroll_loops(program_t *prog, size_t from, size_t *to, opt_report_t *report) {
+	if (report != NULL)
+		opt_report_unroll(prog, from, *to, report);
+
+	bool        any = false;
+	const char *why;
+	for (size_t i = from; i < *to && !any; ++ i) {
+		loop_t loop;
+		any = prog->ems[i].type == EM_LOOP_END && opt_match_loop(prog, i, &loop) &&
+		      opt_unrollable(prog, from, &loop, &why) > 0;
+	}
+
+	if (!any)
+		return false;
+
+	program_t out = program_new(*to - from);
+	for (size_t i = from; i < *to; ++ i) {
+		/* Loops are unrolled where their start is pushed, the rest of "S 1 :@" goes away */
+		em_t  *em = &prog->ems[i];
+		loop_t loop;
+		size_t trips = 0;
+		if (i + 2 < *to && em->type == EM_PUSH && prog->ems[i + 2].type == EM_LOOP_BEGIN &&
+		    opt_match_loop(prog, prog->ems[i + 2].ref, &loop))
+			trips = opt_unrollable(prog, from, &loop, &why);
+
+		if (trips == 0) {
+			program_push(&out, *em);
+			continue;
+		}
+
+		program_push(&out, *em);
+		for (size_t trip = 0; trip < trips; ++ trip) {
+			for (size_t j = loop.begin + 1; j < loop.tail; ++ j)
+				program_push(&out, em_copy(&prog->ems[j]));
+		}
+
+		for (size_t j = i + 1; j <= loop.end; ++ j) {
+			if (prog->ems[j].data.type == DATA_STR)
+				alloc_free(prog->ems[j].data.as.str.ptr);
+		}
+
+		i = loop.end;
+	}
+
+	/* The instructions are moved */
+	program_replace(prog, from, *to, &out);
+	*to = from + out.size;
+	return true;
+}
+
+void opt_fuse_loops(program_t *prog, size_t from, size_t to, opt_report_t *report) {
+	for (size_t i = from; i < to; ++ i) {
+		if (prog->ems[i].type != EM_LOOP_END || prog->ems[i].ref < from)
+			continue;
+
+		loop_t loop;
+		if (!opt_match_loop(prog, i, &loop)) {
+			opt_report_add(report, prog->ems[prog->ems[i].ref].off,
+			               "loop left alone, it does not end with \"0 :D N :<\"");
+			continue;
+		}
+
+		prog->ems[loop.tail].type = loop.step? EM_LOOP_STEP : EM_LOOP_TEST;
+		opt_report_add(report, prog->ems[loop.begin].off, "fused the loop control into %s",
+		               em_type_to_cstr(prog->ems[loop.tail].type));
+	}
+}
+
+/* Why a hot push is not fused with the instruction after it, NULL if it is */
+static const char *opt_not_fusable(em_t *em, uint8_t types) {
+	switch (em[1].type) {
+	case EM_DIV:
+		if (em->data.as.int_ == 0)
+			return "it divides by 0";
+		/* Fallthrough */
+
+	case EM_ADD: case EM_SUB: case EM_MUL:
+	case EM_GRT: case EM_LESS: case EM_EQU: case EM_NEQU:
+		return types == 1 << DATA_INT? NULL : "the profile saw values other than ints under it";
+
+	case EM_DUP:
+		return em->data.as.int_ >= 0? NULL : "the depth is negative";
+
+	default: return "";
+	}
+}
+
+void opt_fuse_hot(program_t *prog, profile_t *profile, opt_report_t *report) {
+	assert(prog->size == profile->size);
+
+	for (size_t i = 0; i + 1 < prog->size; ++ i) {
+		em_t *em = &prog->ems[i];
+		if (!opt_push_int(em))
+			continue;
+
+		/* Only pushes that could be fused are reported */
+		const char *why = opt_not_fusable(em, profile->types[i]);
+		if (why != NULL && *why == '\0')
+			continue;
+		else if (profile->ran[i] < PROFILE_HOT_COUNT)
+			opt_report_add(report, em->off, "%s not fused, it ran %zu times, under %d",
+			               em_type_to_cstr(em[1].type), profile->ran[i], (int)PROFILE_HOT_COUNT);
+		else if (why != NULL)
+			opt_report_add(report, em->off, "%s not fused, %s", em_type_to_cstr(em[1].type), why);
+		else {
+			em->type = em[1].type == EM_DUP? EM_PUSH_DUP : EM_PUSH_OP;
+			opt_report_add(report, em->off, "fused the push with %s into %s",
+			               em_type_to_cstr(em[1].type), em_type_to_cstr(em->type));
+		}
+	}
+}
+
+void opt_report_init(opt_report_t *report) {
+	ZERO_STRUCT(report);
+}
+
+void opt_report_destroy(opt_report_t *report) {
+	free(report->remarks);
+}
+
+void opt_report_add(opt_report_t *report, size_t off, const char *fmt, ...) {
+	if (report == NULL)
+		return;
+
+	if (report->size >= report->cap) {
+		report->cap     = report->cap == 0? 64 : report->cap * 2;
+		report->remarks = (opt_remark_t*)realloc(report->remarks,
+		                                         report->cap * sizeof(opt_remark_t));
+		assert(report->remarks != NULL);
+	}
+
+	opt_remark_t *remark = &report->remarks[report->size];
+	remark->off = off;
+	remark->seq = report->size ++;
+
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(remark->msg, sizeof(remark->msg), fmt, args);
+	va_end(args);
+}
+
+static int opt_remark_cmp(const void *a, const void *b) {
+	const opt_remark_t *x = (const opt_remark_t*)a, *y = (const opt_remark_t*)b;
+	if (x->off != y->off)
+		return x->off < y->off? -1 : 1;
+
+	return x->seq < y->seq? -1 : x->seq > y->seq;
+}
+
+void opt_report_fprintf(opt_report_t *report, source_t *src, FILE *file) {
+	qsort(report->remarks, report->size, sizeof(opt_remark_t), opt_remark_cmp);
+
+	for (size_t i = 0; i < report->size; ++ i) {
+		opt_remark_t *remark = &report->remarks[i];
+
+		/* Copies of the same instructions make the same remarks, not always one after another */
+		bool seen = false;
+		for (size_t j = i; j-- > 0 && report->remarks[j].off == remark->off && !seen;)
+			seen = strcmp(report->remarks[j].msg, remark->msg) == 0;
+
+		if (seen)
+			continue;
+
+		location_t loc = source_locate(src, remark->off);
+		fprintf(file, "%s:%zu:%zu: %s\n", loc.path, loc.row, loc.col, remark->msg);
+	}
+}
@@ -0,0 +1,71 @@
+#ifndef OPT_H_HEADER_GUARD
+#define OPT_H_HEADER_GUARD
+
+#include <stdio.h>   /* FILE, fprintf, vsnprintf */
+#include <stdint.h>  /* int64_t */
+#include <stdlib.h>  /* size_t, realloc, free, qsort */
+#include <string.h>  /* strcmp */
+#include <stdarg.h>  /* va_list, va_start, va_end */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "em.h"
+#include "alloc.h"
+#include "profile.h"
+
+/* Counted loops with a constant start and bound that run at most this many times are unrolled */
+#ifndef OPT_UNROLL_MAX_TRIPS
+#	define OPT_UNROLL_MAX_TRIPS 4
+#endif
+
+/* How many instructions an unrolled loop can grow into */
+#ifndef OPT_UNROLL_MAX_EMS
+#	define OPT_UNROLL_MAX_EMS 64
+#endif
+
+#define OPT_REMARK_MAX 96
+
+/* What a pass did to the instructions at an offset of the source, or why it left them alone */
+typedef struct {
+	size_t off, seq; /* seq keeps the remarks about one offset in the order they were made */
+	char   msg[OPT_REMARK_MAX];
+} opt_remark_t;
+
+/* The passes take a report they add their remarks to, which can be NULL */
+typedef struct {
+	opt_remark_t *remarks;
+	size_t        size, cap;
+} opt_report_t;
+
+void opt_report_init   (opt_report_t *report);
+void opt_report_destroy(opt_report_t *report);
+
+void opt_report_add(opt_report_t *report, size_t off, const char *fmt, ...);
+
+/* One line per remark, "PATH:ROW:COL: MSG", in source order. The same remark is only written once,
+   since unrolled and inlined instructions are copies that share an offset */
+void opt_report_fprintf(opt_report_t *report, source_t *src, FILE *file);
+
+/* Both passes work on cross-referenced instructions from from up to to, and look for counted
+   loops, which keep their counter on top of the stack:
+
+     :@ K ;) BODY 0 :D N :< @:
+
+   where K and N are ints and :< can be any comparison.
+
+   Unrolling replaces a loop that starts with a constant counter ("S 1 :@"), runs only a few times
+   and has a body that does not reach the counter, with copies of "K ;) BODY". Returns whether it
+   unrolled anything, the range then has to be cross-referenced again */
+bool opt_unroll_loops(program_t *prog, size_t from, size_t *to, opt_report_t *report);
+
+/* Turns the 0 of "0 :D N :<" into a single instruction that tests the counter and jumps, and also
+   steps the counter if the loop begins with "K ;)". The instructions it stands for are kept after
+   it, and are ran instead whenever the top of the stack is not an int */
+void opt_fuse_loops(program_t *prog, size_t from, size_t to, opt_report_t *report);
+
+/* Turns the hot pushes of an int followed by an arithmetic, comparison or :D into
+   superinstructions, the same way. Arithmetic and comparisons are only fused if the profile saw
+   nothing but ints under the pushed value */
+void opt_fuse_hot(program_t *prog, profile_t *profile, opt_report_t *report);
+
+#endif
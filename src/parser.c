@@ -1,4 +1,5 @@
 #include "parser.h"
+#include "module.h"
 
 static const char *parser_err_to_cstr_map[PARSER_ERRS_COUNT] = {
 	[PARSER_OK] = "Ok",
@@ -9,6 +10,12 @@ static const char *parser_err_to_cstr_map[PARSER_ERRS_COUNT] = {
 	[PARSER_ERR_UNEXPECTED_END]      = "Unexpected end",
 	[PARSER_ERR_ILLEGAL_PRINT_NEST]  = "Illegal print nesting",
 	[PARSER_ERR_EXPECTED_END]        = "Expected matching end",
+	[PARSER_ERR_EXPECTED_NAME]       = "Expected a name",
+	[PARSER_ERR_ILLEGAL_DEF_NEST]    = "Illegal subroutine nesting",
+	[PARSER_ERR_REDEFINED]           = "Subroutine redefined",
+	[PARSER_ERR_UNKNOWN_SUBROUTINE]  = "Unknown subroutine",
+	[PARSER_ERR_IMPORT]              = "Failed to import",
+	[PARSER_ERR_TOKEN_TOO_LONG]      = "Token too long",
 };
 
 const char *parser_err_to_cstr(parser_err_t err) {
@@ -16,12 +23,38 @@ const char *parser_err_to_cstr(parser_err_t err) {
 	return parser_err_to_cstr_map[err];
 }
 
+static const char *parser_stage_to_cstr_map[PARSER_STAGES_COUNT] = {
+	[PARSER_STAGE_LEX]       = "lex",
+	[PARSER_STAGE_CROSS_REF] = "cross-ref",
+	[PARSER_STAGE_LINK]      = "link",
+	[PARSER_STAGE_UNROLL]    = "unroll",
+	[PARSER_STAGE_FUSE]      = "fuse",
+	[PARSER_STAGE_HOT]       = "hot",
+};
+
+const char *parser_stage_to_cstr(parser_stage_t stage) {
+	assert(stage < PARSER_STAGES_COUNT && stage >= 0);
+	return parser_stage_to_cstr_map[stage];
+}
+
+parser_stage_t parser_stage_from_cstr(const char *str) {
+	parser_stage_t stage = 0;
+	for (; stage < PARSER_STAGES_COUNT; ++ stage) {
+		if (strcmp(parser_stage_to_cstr_map[stage], str) == 0)
+			break;
+	}
+
+	return stage;
+}
+
 parser_result_t parser_ok(void) {
 	return (parser_result_t){.err = PARSER_OK};
 }
 
-parser_result_t parser_err(parser_err_t err, const char *path, size_t row, size_t col) {
-	return (parser_result_t){.err = err, .path = path, .row = row, .col = col};
+/* The offset can be in an imported file */
+parser_result_t parser_err(parser_t *p, parser_err_t err, size_t off) {
+	location_t loc = source_locate(p->src, off);
+	return (parser_result_t){.err = err, .path = loc.path, .row = loc.row, .col = loc.col};
 }
 
 parser_t *parser_new(size_t prog_cap) {
@@ -29,13 +62,28 @@ parser_t *parser_new(size_t prog_cap) {
 	assert(p != NULL);
 	ZERO_STRUCT(p);
 
-	p->row  = 1;
 	p->prog = program_new(prog_cap);
+	p->dir  = -1;
 	return p;
 }
 
+/* Only the lines are counted here, the lexer itself just keeps byte offsets */
+static void parser_scan(parser_t *p, size_t len) {
+	assert(p->path != NULL);
+	if (p->src == NULL) {
+		p->src      = source_new(p->path);
+		p->prog.src = source_ref(p->src);
+	}
+
+	p->len  = len;
+	p->base = source_scan(p->src, p->in, len);
+}
+
 void parser_load_mem(parser_t *p, const char *in) {
-	p->in = (char*)in;
+	p->in  = (char*)in;
+	p->pos = 0;
+	p->ch  = 0;
+	parser_scan(p, strlen(in));
 }
 
 int parser_load_file(parser_t *p, const char *path) {
@@ -47,17 +95,25 @@ int parser_load_file(parser_t *p, const char *path) {
 	if (file == NULL)
 		return -1;
 
+	struct stat st;
+	if (stat(p->path, &st) == 0) {
+		p->root_file = true;
+		p->root_dev  = st.st_dev;
+		p->root_ino  = st.st_ino;
+	}
+
 	fseek(file, 0, SEEK_END);
 	size_t size = (size_t)ftell(file);
 	rewind(file);
 
-	p->in = (char*)malloc(size + 1);
+	p->in = (char*)alloc_malloc(ALLOC_PARSER_INPUT, size + 1);
 	assert(p->in != NULL);
 
 	if (size > 0)
 		assert(fread(p->in, size, 1, file) > 0);
 
 	p->in[size] = '\0';
+	parser_scan(p, size);
 
 	fclose(file);
 	return 0;
@@ -68,79 +124,177 @@ void parser_destroy(parser_t *p) {
 
 	if (p->from_file) {
 		assert(p->in != NULL);
-		free(p->in);
+		alloc_free(p->in);
 	}
 
+	if (p->src != NULL)
+		source_release(p->src);
+
+	for (size_t i = 0; i < p->vars_count; ++ i)
+		alloc_free(p->vars[i]);
+
+	for (size_t i = 0; i < p->imports_count; ++ i)
+		alloc_free(p->imports[i].path);
+
+	for (size_t i = 0; i < p->modules_count; ++ i) {
+		module_release(p->modules[i].m);
+		alloc_free(p->modules[i].path);
+	}
+
+	alloc_free(p->imports);
+	alloc_free(p->modules);
+	free(p->vars);
+	free(p->vars_table);
 	free(p);
 }
 
 #define PARSER_END(P) ((P)->ch == '\0')
 
-#define PARSER_TOK_ADD(P, CH) \
-	(assert((P)->tok_len < PARSER_MAX_TOKEN_LENGTH), (P)->tok[(P)->tok_len ++] = CH)
+/* Offset of the current character in the source */
+#define PARSER_OFF(P) ((P)->base + (P)->pos - 1)
 
-#define PARSER_TOK_CLEAR(P)     ((P)->tok_len = 0)
-#define PARSER_TOK_NULL_TERM(P) ((P)->tok[(P)->tok_len] = '\0')
+static void parser_advance(parser_t *p) {
+	p->ch = p->in[p->pos ++];
+}
 
-#define EXPAND_LOCATION(STRUCT) (STRUCT)->path, (STRUCT)->row, (STRUCT)->col
+/* Makes the character at idx of the input the current one */
+static void parser_seek(parser_t *p, size_t idx) {
+	p->pos = idx;
+	parser_advance(p);
+}
 
-static void parser_advance(parser_t *p) {
-	if (p->ch == '\n') {
-		++ p->row;
-		p->col = 0;
+/* Returns 0 for an unknown escape */
+static char parser_escape(char ch) {
+	switch (ch) {
+	case 'n':  return '\n';
+	case 'r':  return '\r';
+	case 't':  return '\t';
+	case 'f':  return '\f';
+	case 'v':  return '\v';
+	case 'b':  return '\b';
+	case 'a':  return '\a';
+	case '"':  return '"';
+	case 'e':  return 27;
+	case '\\': return '\\';
+
+	default: return 0;
 	}
+}
 
-	p->ch = p->in[p->pos ++];
-	if (PARSER_END(p))
-		return;
+/* The scanners below are shared by the parser and parser_next_token. They look at the len bytes of
+   in, which also end at a 0 byte, and never go past a newline */
+#define PARSER_SCAN_END(IN, LEN, IDX) ((IDX) >= (LEN) || (IN)[IDX] == '\0')
 
-	++ p->col;
+static size_t parser_skip_space(const char *in, size_t len, size_t idx) {
+	for (; !PARSER_SCAN_END(in, len, idx) && isspace((unsigned char)in[idx]); ++ idx);
+	return idx;
 }
 
-static parser_result_t parser_parse_quotes(parser_t *p) {
-	PARSER_TOK_CLEAR(p);
-	size_t start_row = p->row, start_col = p->col;
+static size_t parser_line_end(const char *in, size_t len, size_t idx) {
+	for (; !PARSER_SCAN_END(in, len, idx) && in[idx] != '\n'; ++ idx);
+	return idx;
+}
 
-	bool escape = false;
-	while (true) {
-		parser_advance(p);
-		if (PARSER_END(p) || p->ch == '\n')
-			return parser_err(PARSER_ERR_UNTERMINATED_QUOTES, p->path, start_row, start_col);
+/* Adds a character to the token, which has room for PARSER_MAX_TOKEN_LENGTH characters and the 0
+   byte. Only counts it if tok is NULL or full, so a token that is too long is still scanned whole.
+   The length is kept in a local by the scanners, tok can alias anything */
+static size_t parser_scan_add(char *tok, size_t tok_len, char ch) {
+	if (tok != NULL && tok_len < PARSER_MAX_TOKEN_LENGTH)
+		tok[tok_len] = ch;
+
+	return tok_len + 1;
+}
+
+static parser_err_t parser_scan_end(char *tok, size_t tok_len) {
+	if (tok_len > PARSER_MAX_TOKEN_LENGTH)
+		return PARSER_ERR_TOKEN_TOO_LONG;
+
+	if (tok != NULL)
+		tok[tok_len] = '\0';
 
+	return PARSER_OK;
+}
+
+/* Scans the string in quotes at start, the contents go into tok unless it is NULL. end is set past
+   the closing quote, or to the end of the line if there is none. After an unknown escape scanning
+   goes on to the closing quote, so the first error is returned with its index in err_at */
+static parser_err_t parser_scan_quotes(const char *in, size_t len, size_t start, char *tok,
+                                       size_t *tok_len, size_t *end, size_t *err_at) {
+	parser_err_t err = PARSER_OK;
+	bool         escape = false;
+	size_t       n = 0;
+
+	for (size_t i = start + 1; !PARSER_SCAN_END(in, len, i) && in[i] != '\n'; ++ i) {
 		if (escape) {
-			switch (p->ch) {
-			case 'n':  PARSER_TOK_ADD(p, '\n'); break;
-			case 'r':  PARSER_TOK_ADD(p, '\r'); break;
-			case 't':  PARSER_TOK_ADD(p, '\t'); break;
-			case 'f':  PARSER_TOK_ADD(p, '\f'); break;
-			case 'v':  PARSER_TOK_ADD(p, '\v'); break;
-			case 'b':  PARSER_TOK_ADD(p, '\b'); break;
-			case 'a':  PARSER_TOK_ADD(p, '\a'); break;
-			case '"':  PARSER_TOK_ADD(p, '"');  break;
-			case 'e':  PARSER_TOK_ADD(p, 27);   break;
-			case '\\': PARSER_TOK_ADD(p, '\\'); break;
-
-			default: return parser_err(PARSER_ERR_UNKNOWN_ESCAPE, EXPAND_LOCATION(p));
+			char ch = parser_escape(in[i]);
+			if (ch == 0 && err == PARSER_OK) {
+				err     = PARSER_ERR_UNKNOWN_ESCAPE;
+				*err_at = i;
 			}
 
+			n      = parser_scan_add(tok, n, ch);
 			escape = false;
-		} else if (p->ch == '\\')
+		} else if (in[i] == '\\')
 			escape = true;
-		else if (p->ch == '"')
-			break;
-		else
-			PARSER_TOK_ADD(p, p->ch);
+		else if (in[i] == '"') {
+			*end     = i + 1;
+			*tok_len = n;
+			if (err == PARSER_OK && (err = parser_scan_end(tok, n)) != PARSER_OK)
+				*err_at = start;
+
+			return err;
+		} else
+			n = parser_scan_add(tok, n, in[i]);
+	}
+
+	*tok_len = n;
+
+	*end    = parser_line_end(in, len, start);
+	*err_at = start;
+	return PARSER_ERR_UNTERMINATED_QUOTES;
+}
+
+/* Scans the token at start up to the next whitespace into tok. A backslash before a quote is left
+   out, so the token can begin with one. end is set past the token, or past the backslash if it
+   escapes nothing */
+static parser_err_t parser_scan_plain(const char *in, size_t len, size_t start, char *tok,
+                                      size_t *tok_len, size_t *end, bool *is_int) {
+	size_t i = start, n = 0;
+	if (in[i] == '\\') {
+		++ i;
+		if (PARSER_SCAN_END(in, len, i) || isspace((unsigned char)in[i])) {
+			*end     = i;
+			*tok_len = 0;
+			return PARSER_ERR_UNEXPECTED_ESCAPE;
+		} else if (in[i] != '"')
+			n = parser_scan_add(tok, n, '\\');
 	}
-	parser_advance(p);
 
-	PARSER_TOK_NULL_TERM(p);
-	char *str = strcpy_to_heap(p->tok);
-	assert(str != NULL);
+	bool digits = true;
+	for (; !PARSER_SCAN_END(in, len, i) && !isspace((unsigned char)in[i]); ++ i) {
+		if (digits && !(n == 0 && in[i] == '-') && !isdigit((unsigned char)in[i]))
+			digits = false;
 
-	em_t em = em_new_with_data(EM_PUSH, data_new_str(str));
-	em.row  = start_row;
-	em.col  = start_col;
-	em.path = p->path;
+		n = parser_scan_add(tok, n, in[i]);
+	}
+
+	*is_int  = digits && !(n == 1 && in[start] == '-');
+	*end     = i;
+	*tok_len = n;
+	return parser_scan_end(tok, n);
+}
+
+static parser_result_t parser_parse_quotes(parser_t *p) {
+	size_t       start = PARSER_OFF(p), end, err_at;
+	parser_err_t err   = parser_scan_quotes(p->in, p->len, p->pos - 1, p->tok, &p->tok_len, &end,
+	                                        &err_at);
+	if (err != PARSER_OK)
+		return parser_err(p, err, p->base + err_at);
+
+	parser_seek(p, end);
+
+	em_t em = em_new_with_data(EM_PUSH, data_new_str(str_new_lit(p->tok, p->tok_len)));
+	em.off = start;
 
 	program_push(&p->prog, em);
 	return parser_ok();
@@ -169,70 +323,272 @@ static const char *em_to_keyword_map[EM_TYPES_COUNT] = {
 	[EM_LOOP_BEGIN] = ":@",
 	[EM_LOOP_END]   = "@:",
 
+	[EM_SPAWN_BEGIN] = ":{",
+	[EM_SPAWN_END]   = "}:",
+
+	[EM_TASK_BEGIN] = "~(",
+	[EM_TASK_END]   = ")~",
+
+	[EM_DEF_BEGIN] = ":^",
+	[EM_DEF_END]   = "^:",
+	[EM_CALL]      = "^_^",
+
 	[EM_EXIT] = "X_X",
 
 	[EM_DUP]  = ":D",
 	[EM_SWAP] = ":S",
 
+	[EM_LOAD]  = "<-",
+	[EM_STORE] = "->",
+
+	[EM_CAT]    = ":&",
+	[EM_LEN]    = ":#",
+	[EM_CMP]    = ":=",
+	[EM_SLICE]  = ":%",
+	[EM_TO_STR] = ":$",
+
+	[EM_PACK]  = ":[",
+	[EM_INDEX] = ":]",
+	[EM_SUM]   = "[+]",
+	[EM_MIN]   = "[<]",
+	[EM_MAX]   = "[>]",
+	[EM_SORT]  = "[/]",
+
+	[EM_MAP_NEW] = "{}",
+	[EM_MAP_PUT] = "{+}",
+	[EM_MAP_GET] = "{.}",
+	[EM_MAP_HAS] = "{?}",
+	[EM_MAP_DEL] = "{-}",
+
+	[EM_YIELD]    = "~~",
+	[EM_CHAN_NEW] = "<~>",
+	[EM_SEND]     = "~>",
+	[EM_RECV]     = "<~",
+
+	[EM_READ_INT]   = "#?",
+	[EM_READ_TOKEN] = ";?",
+	[EM_READ_LINE]  = ":?",
+	[EM_OPEN]       = "<:",
+
 #ifdef DEBUG
 	[EM_DEBUG] = "D:",
 #endif
 };
 
-static parser_result_t parser_parse_plain(parser_t *p) {
-	PARSER_TOK_CLEAR(p);
-	size_t start_row = p->row, start_col = p->col;
-
-	if (p->ch == '\\') {
-		parser_advance(p);
-		if (PARSER_END(p) || isspace(p->ch))
-			return parser_err(PARSER_ERR_UNEXPECTED_ESCAPE, p->path, start_row, start_col);
-		else if (p->ch != '"')
-			PARSER_TOK_ADD(p, '\\');
-	}
-
-	bool is_int = true;
-	do {
-		if (is_int && !(p->tok_len == 0 && p->ch == '-')) {
-			if (!isdigit(p->ch))
-				is_int = false;
+/* What a plain token is. The keywords that push a string get EM_PUSH, :) and :( EM_PRINT_END */
+static token_kind_t parser_classify(const char *tok, bool is_int, em_type_t *type) {
+	for (size_t i = 0; i < EM_TYPES_COUNT; ++ i) {
+		if (em_to_keyword_map[i] != NULL && strcmp(tok, em_to_keyword_map[i]) == 0) {
+			*type = (em_type_t)i;
+			return TOKEN_KEYWORD;
 		}
+	}
 
-		PARSER_TOK_ADD(p, p->ch);
+	*type = EM_PUSH;
+	if (strcmp(tok, ":x") == 0)
+		return TOKEN_COMMENT;
+	else if (strcmp(tok, PARSER_IMPORT_KEYWORD) == 0)
+		return TOKEN_IMPORT;
+	else if (strcmp(tok, ":)") == 0 || strcmp(tok, ":(") == 0) {
+		*type = EM_PRINT_END;
+		return TOKEN_KEYWORD;
+	} else if (strcmp(tok, ":3")  == 0 || strcmp(tok, ";3") == 0 || strcmp(tok, "<3") == 0 ||
+	           strcmp(tok, "x3")  == 0 || strcmp(tok, "><>") == 0)
+		return TOKEN_KEYWORD;
+	else
+		return is_int? TOKEN_INT : TOKEN_WORD;
+}
 
-		parser_advance(p);
-		if (PARSER_END(p))
-			return parser_ok();
-	} while (!isspace(p->ch));
+/* Marks an instruction that still has to take its name */
+#define PARSER_NAME_LATER SIZE_MAX
 
-	if (p->tok_len == 1 && p->tok[0] == '-')
-		is_int = false;
+/* Subroutine definitions, calls and variables take the name pushed right before them. It has to
+   come from the same input, the REPL might have already ran anything older */
+static parser_result_t parser_take_name(parser_t *p, em_t *em) {
+	em_t *prev = p->prog.size > p->pending? &p->prog.ems[p->prog.size - 1] : NULL;
+	if (prev == NULL || prev->type != EM_PUSH || prev->data.type != DATA_STR)
+		return parser_err(p, PARSER_ERR_EXPECTED_NAME, em->off);
 
-	PARSER_TOK_NULL_TERM(p);
+	em->data = prev->data;
+	-- p->prog.size;
+	return parser_ok();
+}
 
-	em_t em;
-	for (size_t i = 0; i < EM_TYPES_COUNT; ++ i) {
-		if (em_to_keyword_map[i] == NULL)
-			continue;
+static size_t *parser_vars_find(parser_t *p, const char *name, size_t len) {
+	size_t mask = p->vars_table_cap - 1;
+	size_t i    = (size_t)hash_bytes(name, len) & mask;
+	for (; p->vars_table[i] != 0; i = (i + 1) & mask) {
+		str_t *var = p->vars[p->vars_table[i] - 1];
+		if (var->size == len && memcmp(var->buf, name, len) == 0)
+			break;
+	}
+
+	return &p->vars_table[i];
+}
+
+/* Variables get their slots in order of their first use */
+static size_t parser_var_slot(parser_t *p, data_t *name) {
+	if (p->vars_count * 2 >= p->vars_table_cap) {
+		free(p->vars_table);
+		p->vars_table_cap = p->vars_table_cap == 0? 64 : p->vars_table_cap * 2;
+		p->vars_table     = (size_t*)calloc(p->vars_table_cap, sizeof(size_t));
+		assert(p->vars_table != NULL);
 
-		if (strcmp(p->tok, em_to_keyword_map[i]) == 0) {
-			em = em_new((em_type_t)i);
-			goto push;
+		for (size_t i = 0; i < p->vars_count; ++ i)
+			*parser_vars_find(p, p->vars[i]->buf, p->vars[i]->size) = i + 1;
+	}
+
+	size_t *entry = parser_vars_find(p, name->as.str.ptr->buf, name->as.str.len);
+	if (*entry != 0)
+		return *entry - 1;
+
+	if (p->vars_count >= p->vars_cap) {
+		p->vars_cap = p->vars_cap == 0? 64 : p->vars_cap * 2;
+		p->vars     = (str_t**)realloc(p->vars, p->vars_cap * sizeof(str_t*));
+		assert(p->vars != NULL);
+	}
+
+	p->vars[p->vars_count] = str_new_lit(name->as.str.ptr->buf, name->as.str.len);
+	*entry = ++ p->vars_count;
+	return *entry - 1;
+}
+
+/* Paths are relative to the directory of the file they are in, if it has one */
+static char *parser_resolve(const char *from, const char *path, size_t len) {
+	const char *slash = strrchr(from, '/');
+	size_t      dir   = path[0] == '/' || slash == NULL? 0 : (size_t)(slash - from) + 1;
+
+	char *resolved = (char*)alloc_malloc(ALLOC_SOURCE, dir + len + 1);
+	assert(resolved != NULL);
+	memcpy(resolved, from, dir);
+	memcpy(resolved + dir, path, len);
+	resolved[dir + len] = '\0';
+	return resolved;
+}
+
+static bool parser_imported(parser_t *p, module_t *m) {
+	if (p->root_file && m->dev == p->root_dev && m->ino == p->root_ino)
+		return true;
+
+	for (size_t i = 0; i < p->modules_count; ++ i) {
+		module_t *it = p->modules[i].m;
+		if (it->dev == m->dev && it->ino == m->ino)
+			return true;
+	}
+
+	return false;
+}
+
+/* Copies the instructions of the module in, expanding its own imports where they were. Modules
+   that were already imported, including the ones being imported right now and the main input,
+   are skipped, so imports can not loop */
+static parser_result_t parser_import(parser_t *p, const char *path, size_t off) {
+	module_t       *m;
+	parser_result_t result = module_get(p->dir, path, &m);
+	if (result.err != PARSER_OK)
+		return result.path == NULL? parser_err(p, result.err, off) : result;
+
+	if (parser_imported(p, m)) {
+		module_release(m);
+		return parser_ok();
+	}
+
+	if (p->modules_count >= p->modules_cap) {
+		p->modules_cap = p->modules_cap == 0? 8 : p->modules_cap * 2;
+		p->modules     = (imported_t*)alloc_realloc(ALLOC_SOURCE, p->modules,
+		                                            p->modules_cap * sizeof(imported_t));
+		assert(p->modules != NULL);
+	}
+
+	imported_t *imported = &p->modules[p->modules_count ++];
+	*imported = (imported_t){.m = m, .at = p->prog.size};
+
+	imported->path = (char*)alloc_malloc(ALLOC_SOURCE, strlen(path) + 1);
+	assert(imported->path != NULL);
+	strcpy(imported->path, path);
+
+	size_t base = source_link(p->src, m->src), next = 0;
+	for (size_t i = 0; i <= m->prog.size; ++ i) {
+		for (; next < m->imports_count && m->imports[next].at == i; ++ next) {
+			import_t *import   = &m->imports[next];
+			char     *resolved = parser_resolve(path, import->path, strlen(import->path));
+			result = parser_import(p, resolved, source_relocate(base, import->off));
+			alloc_free(resolved);
+			if (result.err != PARSER_OK)
+				return result;
 		}
+
+		if (i == m->prog.size)
+			break;
+
+		em_t em = em_copy(&m->prog.ems[i]);
+		em.off  = source_relocate(base, em.off);
+		if (em.type == EM_LOAD || em.type == EM_STORE)
+			em.ref = parser_var_slot(p, &em.data);
+
+		program_push(&p->prog, em);
+	}
+
+	return parser_ok();
+}
+
+/* Imports take the path pushed right before them, like names */
+static parser_result_t parser_parse_import(parser_t *p, size_t off) {
+	em_t em = em_new(EM_PUSH);
+	em.off  = off;
+
+	parser_result_t result = parser_take_name(p, &em);
+	if (result.err != PARSER_OK)
+		return result;
+
+	/* Modules are cached, the same module can be opened from different directories */
+	const char *from = p->module? "" : p->path;
+	char       *path = parser_resolve(from, em.data.as.str.ptr->buf, em.data.as.str.len);
+	alloc_free(em.data.as.str.ptr);
+
+	if (!p->module) {
+		result = parser_import(p, path, off);
+		alloc_free(path);
+		return result;
 	}
 
-	if (strcmp(p->tok, ":x") == 0) {
-		while (!PARSER_END(p) && p->ch != '\n')
-			parser_advance(p);
+	if (p->imports_count >= p->imports_cap) {
+		p->imports_cap = p->imports_cap == 0? 8 : p->imports_cap * 2;
+		p->imports     = (import_t*)alloc_realloc(ALLOC_SOURCE, p->imports,
+		                                          p->imports_cap * sizeof(import_t));
+		assert(p->imports != NULL);
+	}
 
+	p->imports[p->imports_count ++] = (import_t){.at = p->prog.size, .off = off, .path = path};
+	return parser_ok();
+}
+
+static parser_result_t parser_parse_plain(parser_t *p) {
+	size_t       start = PARSER_OFF(p), end;
+	bool         is_int;
+	parser_err_t err = parser_scan_plain(p->in, p->len, p->pos - 1, p->tok, &p->tok_len, &end,
+	                                     &is_int);
+	if (err != PARSER_OK)
+		return parser_err(p, err, start);
+
+	parser_seek(p, end);
+
+	em_t         em;
+	em_type_t    type;
+	token_kind_t kind = parser_classify(p->tok, is_int, &type);
+	if (kind == TOKEN_COMMENT) {
+		parser_seek(p, parser_line_end(p->in, p->len, end));
 		return parser_ok();
-	} else if (strcmp(p->tok, ":)") == 0)
-		em = em_new_with_data(EM_PRINT_END, data_new_int(DATA_STDOUT));
-	else if (strcmp(p->tok, ":(") == 0)
-		em = em_new_with_data(EM_PRINT_END, data_new_int(DATA_STDERR));
-	else if (strcmp(p->tok, ":3")  == 0 || strcmp(p->tok, ";3") == 0 ||
-	         strcmp(p->tok, "<3")  == 0 || strcmp(p->tok, "x3") == 0 ||
-	         strcmp(p->tok, "><>") == 0) {
+	} else if (kind == TOKEN_IMPORT)
+		return parser_parse_import(p, start);
+	else if (kind == TOKEN_INT)
+		em = em_new_with_data(EM_PUSH, data_new_int((int64_t)atoll(p->tok)));
+	else if (kind == TOKEN_WORD)
+		em = em_new_with_data(EM_PUSH, data_new_str(str_new_lit(p->tok, p->tok_len)));
+	else if (type == EM_PRINT_END)
+		em = em_new_with_data(EM_PRINT_END,
+		                      data_new_int(p->tok[1] == ')'? DATA_STDOUT : DATA_STDERR));
+	else if (type == EM_PUSH) {
 		const char *text;
 		switch (p->tok[0]) {
 		case ':': text = "meow";        break;
@@ -244,33 +600,34 @@ static parser_result_t parser_parse_plain(parser_t *p) {
 		default: assert(0);
 		}
 
-		char *str = strcpy_to_heap(text);
-		assert(str != NULL);
+		em = em_new_with_data(EM_PUSH, data_new_str(str_new_lit(text, strlen(text))));
+	} else
+		em = em_new(type);
 
-		em = em_new_with_data(EM_PUSH, data_new_str(str));
-	} else if (is_int)
-		em = em_new_with_data(EM_PUSH, data_new_int((int64_t)atoll(p->tok)));
-	else {
-		char *str = strcpy_to_heap(p->tok);
-		assert(str != NULL);
+	em.off = start;
 
-		em = em_new_with_data(EM_PUSH, data_new_str(str));
+	/* The name of the first instruction of a chunk is at the end of the chunk before it */
+	if (p->chunk && p->prog.size == 0 && (em.type == EM_DEF_BEGIN || em.type == EM_CALL ||
+	                                      em.type == EM_LOAD || em.type == EM_STORE))
+		em.ref = PARSER_NAME_LATER;
+	else if (em.type == EM_DEF_BEGIN || em.type == EM_CALL || em.type == EM_LOAD ||
+	         em.type == EM_STORE) {
+		parser_result_t result = parser_take_name(p, &em);
+		if (result.err != PARSER_OK)
+			return result;
+
+		if (!p->chunk && !p->module && (em.type == EM_LOAD || em.type == EM_STORE))
+			em.ref = parser_var_slot(p, &em.data);
 	}
 
-push:
-	em.row  = start_row;
-	em.col  = start_col;
-	em.path = p->path;
 	program_push(&p->prog, em);
 	return parser_ok();
 }
 
 static parser_result_t parser_parse_next(parser_t *p) {
-	while (isspace(p->ch)) {
-		parser_advance(p);
-		if (PARSER_END(p))
-			return parser_ok();
-	}
+	parser_seek(p, parser_skip_space(p->in, p->len, p->pos - 1));
+	if (PARSER_END(p))
+		return parser_ok();
 
 	if (p->ch == '"')
 		return parser_parse_quotes(p);
@@ -278,24 +635,81 @@ static parser_result_t parser_parse_next(parser_t *p) {
 		return parser_parse_plain(p);
 }
 
+static const char *token_kind_to_cstr_map[TOKEN_KINDS_COUNT] = {
+	[TOKEN_INT]     = "int",
+	[TOKEN_STR]     = "str",
+	[TOKEN_WORD]    = "word",
+	[TOKEN_KEYWORD] = "keyword",
+	[TOKEN_IMPORT]  = "import",
+	[TOKEN_COMMENT] = "comment",
+	[TOKEN_ERR]     = "err",
+};
+
+const char *token_kind_to_cstr(token_kind_t kind) {
+	assert(kind < TOKEN_KINDS_COUNT && kind >= 0);
+	return token_kind_to_cstr_map[kind];
+}
+
+/* The same scanners as the parser, but an error does not stop it. The error covers the token it
+   is in, an unterminated string runs up to the end of the line */
+bool parser_next_token(const char *in, size_t len, size_t *pos, token_t *tok) {
+	*pos = parser_skip_space(in, len, *pos);
+	if (PARSER_SCAN_END(in, len, *pos))
+		return false;
+
+	ZERO_STRUCT(tok);
+	tok->off = *pos;
+
+	/* Strings are only scanned, plain tokens are copied to be classified */
+	char         buf[PARSER_MAX_TOKEN_LENGTH + 1];
+	size_t       buf_len, end, err_at;
+	bool         is_int;
+	parser_err_t err;
+	if (in[*pos] == '"') {
+		err       = parser_scan_quotes(in, len, *pos, NULL, &buf_len, &end, &err_at);
+		tok->kind = TOKEN_STR;
+		tok->type = EM_PUSH;
+	} else {
+		err = parser_scan_plain(in, len, *pos, buf, &buf_len, &end, &is_int);
+		if (err == PARSER_OK) {
+			tok->kind = parser_classify(buf, is_int, &tok->type);
+			if (tok->kind == TOKEN_COMMENT)
+				end = parser_line_end(in, len, end);
+		}
+	}
+
+	if (err != PARSER_OK) {
+		tok->kind = TOKEN_ERR;
+		tok->err  = err;
+	}
+
+	tok->len = end - tok->off;
+	*pos     = end;
+	return true;
+}
+
 #define PARSER_MAX_NESTS 256
 
-static parser_result_t parser_cross_ref(parser_t *p) {
+static parser_result_t parser_cross_ref(parser_t *p, size_t from, size_t to) {
 	em_type_t expects[PARSER_MAX_NESTS];
 	size_t    begins [PARSER_MAX_NESTS];
 	size_t    nest = 0;
 
 	bool print = false;
-	for (size_t i = 0; i < p->prog.size; ++ i) {
+	for (size_t i = from; i < to; ++ i) {
 		em_t *em = &p->prog.ems[i];
+		if (em->type == EM_DEF_BEGIN && nest != 0)
+			return parser_err(p, PARSER_ERR_ILLEGAL_DEF_NEST, em->off);
+
 		switch (em->type) {
 		case EM_PRINT_BEGIN:
 			if (print)
-				return parser_err(PARSER_ERR_ILLEGAL_PRINT_NEST, EXPAND_LOCATION(em));
+				return parser_err(p, PARSER_ERR_ILLEGAL_PRINT_NEST, em->off);
 			print = true;
 			/* Fallthrough */
 
-		case EM_IF_BEGIN: case EM_LOOP_BEGIN:
+		case EM_IF_BEGIN: case EM_LOOP_BEGIN: case EM_SPAWN_BEGIN: case EM_TASK_BEGIN:
+		case EM_DEF_BEGIN:
 			expects[nest]   = em->type + 1; /* Assuming the end type is right after the begin type */
 			begins[nest ++] = i;
 			break;
@@ -304,11 +718,12 @@ static parser_result_t parser_cross_ref(parser_t *p) {
 			print = false;
 			/* Fallthrough */
 
-		case EM_IF_END: case EM_LOOP_END:
+		case EM_IF_END: case EM_LOOP_END: case EM_SPAWN_END: case EM_TASK_END:
+		case EM_DEF_END:
 			if (nest == 0)
-				return parser_err(PARSER_ERR_UNEXPECTED_END, EXPAND_LOCATION(em));
+				return parser_err(p, PARSER_ERR_UNEXPECTED_END, em->off);
 			else if (em->type != expects[nest - 1])
-				return parser_err(PARSER_ERR_UNEXPECTED_END, EXPAND_LOCATION(em));
+				return parser_err(p, PARSER_ERR_UNEXPECTED_END, em->off);
 
 			size_t begin = begins[-- nest];
 			p->prog.ems[begin].ref = i;
@@ -320,31 +735,496 @@ static parser_result_t parser_cross_ref(parser_t *p) {
 	}
 
 	if (nest != 0)
-		return parser_err(PARSER_ERR_EXPECTED_END, EXPAND_LOCATION(&p->prog.ems[begins[nest - 1]]));
+		return parser_err(p, PARSER_ERR_EXPECTED_END, p->prog.ems[begins[nest - 1]].off);
 
 	return parser_ok();
 }
 
-parser_result_t parser_parse(parser_t *p) {
-	parser_advance(p);
-	if (PARSER_END(p)) {
-		parser_result_t result = parser_ok();
-		result.prog = p->prog;
-		return result;
+/* Subroutines up to this many instructions long that do not call anything are inlined */
+#ifndef PARSER_INLINE_MAX_EMS
+#	define PARSER_INLINE_MAX_EMS 16
+#endif
+
+/* Open addressing table from subroutine names to their definitions */
+typedef struct {
+	size_t *idxs; /* Index of the definition + 1, 0 for an empty slot */
+	size_t  cap;
+} defs_t;
+
+static size_t *parser_defs_slot(parser_t *p, defs_t *defs, data_t *name) {
+	size_t i = (size_t)str_hash(name->as.str.ptr, name->as.str.len) & (defs->cap - 1);
+	while (defs->idxs[i] != 0 && data_str_cmp(&p->prog.ems[defs->idxs[i] - 1].data, name) != 0)
+		i = (i + 1) & (defs->cap - 1);
+
+	return &defs->idxs[i];
+}
+
+static parser_result_t parser_defs_collect(parser_t *p, defs_t *defs, size_t to) {
+	size_t count = 0;
+	for (size_t i = 0; i < to; ++ i) {
+		if (p->prog.ems[i].type == EM_DEF_BEGIN)
+			++ count;
 	}
 
+	defs->cap = 16;
+	while (defs->cap < count * 2)
+		defs->cap *= 2;
+
+	defs->idxs = (size_t*)calloc(defs->cap, sizeof(size_t));
+	assert(defs->idxs != NULL);
+
+	for (size_t i = 0; i < to; ++ i) {
+		em_t *em = &p->prog.ems[i];
+		if (em->type != EM_DEF_BEGIN)
+			continue;
+
+		size_t *slot = parser_defs_slot(p, defs, &em->data);
+		if (*slot != 0) {
+			free(defs->idxs);
+			return parser_err(p, PARSER_ERR_REDEFINED, em->off);
+		}
+
+		*slot = i + 1;
+	}
+
+	return parser_ok();
+}
+
+/* Why a subroutine is not inlined, NULL if it is. Print blocks are not inlined, since that could
+   nest them */
+static const char *parser_not_inlinable(parser_t *p, size_t def) {
+	size_t end = p->prog.ems[def].ref;
+	if (end - def - 1 > PARSER_INLINE_MAX_EMS)
+		return "the body is too long";
+
+	for (size_t i = def + 1; i < end; ++ i) {
+		if (p->prog.ems[i].type == EM_CALL)
+			return "the body calls a subroutine";
+		else if (p->prog.ems[i].type == EM_PRINT_BEGIN)
+			return "the body has a print block";
+	}
+
+	return NULL;
+}
+
+static bool parser_inlinable(parser_t *p, size_t def) {
+	return parser_not_inlinable(p, def) == NULL;
+}
+
+/* Replaces the calls of inlinable subroutines in the range with copies of their bodies */
+static void parser_inline(parser_t *p, size_t from, size_t *to) {
+	program_t out = program_new(*to - from);
+	for (size_t i = from; i < *to; ++ i) {
+		em_t *em = &p->prog.ems[i];
+		if (em->type == EM_CALL && parser_inlinable(p, em->ref)) {
+			opt_report_add(p->report, em->off, "inlined %.*s",
+			               (int)em->data.as.str.len, em->data.as.str.ptr->buf);
+			for (size_t j = em->ref + 1; j < p->prog.ems[em->ref].ref; ++ j)
+				program_push(&out, em_copy(&p->prog.ems[j]));
+
+			alloc_free(em->data.as.str.ptr);
+		} else
+			program_push(&out, *em);
+	}
+
+	/* The instructions are moved */
+	program_replace(&p->prog, from, *to, &out);
+	*to = from + out.size;
+}
+
+/* The calls that are left once nothing more can be inlined */
+static void parser_report_calls(parser_t *p, size_t from, size_t to) {
+	if (p->report == NULL)
+		return;
+
+	for (size_t i = from; i < to; ++ i) {
+		em_t *em = &p->prog.ems[i];
+		if (em->type == EM_CALL)
+			opt_report_add(p->report, em->off, "%.*s not inlined, %s",
+			               (int)em->data.as.str.len, em->data.as.str.ptr->buf,
+			               parser_not_inlinable(p, em->ref));
+	}
+}
+
+/* Points the calls in the cross-referenced range at the subroutines they call. Inlining can make
+   more subroutines inlinable, so it repeats until there is nothing left to inline. Every round
+   removes calls, so it always stops */
+static parser_result_t parser_link(parser_t *p, size_t from, size_t *to) {
+	while (true) {
+		defs_t          defs;
+		parser_result_t result = parser_defs_collect(p, &defs, *to);
+		if (result.err != PARSER_OK)
+			return result;
+
+		bool inline_any = false;
+		for (size_t i = from; i < *to; ++ i) {
+			em_t *em = &p->prog.ems[i];
+			if (em->type != EM_CALL)
+				continue;
+
+			size_t def = *parser_defs_slot(p, &defs, &em->data);
+			if (def == 0) {
+				free(defs.idxs);
+				return parser_err(p, PARSER_ERR_UNKNOWN_SUBROUTINE, em->off);
+			}
+
+			em->ref = def - 1;
+			if (parser_inlinable(p, em->ref))
+				inline_any = true;
+		}
+
+		free(defs.idxs);
+		if (!inline_any) {
+			parser_report_calls(p, from, *to);
+			return parser_ok();
+		}
+
+		parser_inline(p, from, to);
+		result = parser_cross_ref(p, from, *to);
+		if (result.err != PARSER_OK)
+			return result;
+	}
+}
+
+static void parser_dump(parser_t *p, parser_stage_t stage) {
+	if (!(p->dump & (1u << stage)))
+		return;
+
+	fprintf(stderr, "ir %s\n", parser_stage_to_cstr(stage));
+	program_fprintf(&p->prog, stderr);
+}
+
+/* Runs on a range that is already cross-referenced and linked. Unrolling moves instructions, so
+   the range is done again then */
+static parser_result_t parser_optimize(parser_t *p, size_t from, size_t *to) {
+	if (opt_unroll_loops(&p->prog, from, to, p->report)) {
+		parser_result_t result = parser_cross_ref(p, from, *to);
+		if (result.err == PARSER_OK)
+			result = parser_link(p, from, to);
+
+		if (result.err != PARSER_OK)
+			return result;
+	}
+	parser_dump(p, PARSER_STAGE_UNROLL);
+
+	opt_fuse_loops(&p->prog, from, *to, p->report);
+	parser_dump(p, PARSER_STAGE_FUSE);
+	return parser_ok();
+}
+
+/* Modules imported by the discarded instructions can be imported again */
+static void parser_rollback(parser_t *p, size_t size) {
+	for (size_t i = size; i < p->prog.size; ++ i) {
+		if (p->prog.ems[i].data.type == DATA_STR)
+			alloc_free(p->prog.ems[i].data.as.str.ptr);
+	}
+
+	while (p->modules_count > 0 && p->modules[p->modules_count - 1].at >= size) {
+		imported_t *imported = &p->modules[-- p->modules_count];
+		module_release(imported->m);
+		alloc_free(imported->path);
+	}
+
+	p->prog.size = size;
+}
+
+static parser_result_t parser_lex(parser_t *p) {
+	parser_advance(p);
+	if (PARSER_END(p))
+		return parser_ok();
+
 	parser_result_t result;
 	do
 		result = parser_parse_next(p);
 	while (result.err == PARSER_OK && !PARSER_END(p));
 
+	return result;
+}
+
+typedef struct {
+	parser_t *p;
+	size_t   *bounds; /* Chunk i runs from bounds[i] up to the newline at bounds[i + 1] - 1 */
+
+	program_t       *progs;
+	parser_result_t *results;
+} chunks_t;
+
+/* The newline at the end of the chunk was replaced with a null, so the lexer stops there like it
+   would at the end of the input */
+static void parser_lex_chunk(void *arg, size_t idx) {
+	chunks_t *c = (chunks_t*)arg;
+
+	size_t   from = c->bounds[idx], to = c->bounds[idx + 1] - 1;
+	parser_t chunk;
+	ZERO_STRUCT(&chunk);
+	chunk.path  = c->p->path;
+	chunk.src   = c->p->src;
+	chunk.in    = c->p->in + from;
+	chunk.pos   = 0;
+	chunk.len   = to - from;
+	chunk.base  = c->p->base + from;
+	chunk.chunk = true;
+	chunk.prog  = program_new(chunk.len / 8 + 16);
+
+	c->results[idx] = parser_lex(&chunk);
+	c->progs[idx]   = chunk.prog;
+}
+
+/* Appends the instructions of a chunk, giving names and slots in the same order as lexing the
+   whole input at once would */
+static parser_result_t parser_join_chunk(parser_t *p, program_t *chunk) {
+	for (size_t i = 0; i < chunk->size; ++ i) {
+		em_t *em = &chunk->ems[i];
+		if (em->ref == PARSER_NAME_LATER) {
+			em->ref = 0;
+
+			parser_result_t result = parser_take_name(p, em);
+			if (result.err != PARSER_OK)
+				return result;
+		}
+
+		if (em->type == EM_LOAD || em->type == EM_STORE)
+			em->ref = parser_var_slot(p, &em->data);
+
+		program_push(&p->prog, *em);
+		em->data = data_new_int(0); /* Moved */
+	}
+
+	return parser_ok();
+}
+
+static parser_result_t parser_lex_parallel(parser_t *p) {
+	size_t count = p->len / PARSER_CHUNK_MIN, threads = pool_threads() * 4;
+	if (count > threads)
+		count = threads;
+
+	/* Every bound after the first is one past a newline, or one past the end of the input */
+	size_t *bounds = (size_t*)malloc((count + 1) * sizeof(size_t));
+	assert(bounds != NULL);
+
+	bounds[0]    = 0;
+	size_t split = 1;
+	for (size_t i = 1; i < count; ++ i) {
+		size_t from = i * (p->len / count);
+		if (from < bounds[split - 1])
+			continue;
+
+		char *nl = (char*)memchr(p->in + from, '\n', p->len - from);
+		if (nl == NULL)
+			break;
+
+		*nl             = '\0';
+		bounds[split ++] = (size_t)(nl - p->in) + 1;
+	}
+	bounds[split] = p->len + 1;
+
+	chunks_t c = {
+		.p       = p,
+		.bounds  = bounds,
+		.progs   = (program_t*)malloc(split * sizeof(program_t)),
+		.results = (parser_result_t*)malloc(split * sizeof(parser_result_t)),
+	};
+	assert(c.progs != NULL && c.results != NULL);
+
+	pool_run(parser_lex_chunk, &c, split);
+
+	/* The first error in the input wins */
+	parser_result_t result = parser_ok();
+	for (size_t i = 0; i < split; ++ i) {
+		if (result.err == PARSER_OK)
+			result = parser_join_chunk(p, &c.progs[i]);
+
+		if (result.err == PARSER_OK)
+			result = c.results[i];
+
+		program_destroy(&c.progs[i]);
+		if (i > 0)
+			p->in[bounds[i] - 1] = '\n';
+	}
+
+	/* Like after lexing the whole input */
+	p->pos = p->len + 1;
+	p->ch  = '\0';
+
+	free(c.results);
+	free(c.progs);
+	free(bounds);
+	return result;
+}
+
+/* Imports are expanded while lexing, in order. A false positive only costs the parallel lexing */
+static bool parser_might_import(parser_t *p) {
+	size_t len = strlen(PARSER_IMPORT_KEYWORD);
+	for (const char *it = p->in, *end = p->in + p->len;
+	     (it = (const char*)memchr(it, PARSER_IMPORT_KEYWORD[0], (size_t)(end - it))) != NULL;
+	     ++ it) {
+		if ((size_t)(end - it) >= len && memcmp(it, PARSER_IMPORT_KEYWORD, len) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+parser_result_t parser_parse(parser_t *p) {
+	double start = time_now();
+
+	/* Only a file is lexed in parallel, the chunks are cut by writing into the input */
+	parser_result_t result = p->from_file && p->len >= PARSER_PARALLEL_MIN && pool_threads() > 1 &&
+	                         !parser_might_import(p)? parser_lex_parallel(p) : parser_lex(p);
+	p->lex_time = time_now() - start;
+	if (result.err != PARSER_OK)
+		return result;
+
+	parser_dump(p, PARSER_STAGE_LEX);
+
+	start  = time_now();
+	result = parser_cross_ref(p, 0, p->prog.size);
+	if (result.err == PARSER_OK) {
+		parser_dump(p, PARSER_STAGE_CROSS_REF);
+		result = parser_link(p, 0, &p->prog.size);
+	}
+
+	if (result.err == PARSER_OK) {
+		parser_dump(p, PARSER_STAGE_LINK);
+		result = parser_optimize(p, 0, &p->prog.size);
+	}
+
+	p->cross_ref_time = time_now() - start;
 	if (result.err != PARSER_OK)
 		return result;
 
-	result = parser_cross_ref(p);
+	p->pending   = p->prog.size;
+	p->prog.vars = p->vars_count;
+	result.prog  = p->prog;
+	return result;
+}
+
+parser_result_t parser_parse_more(parser_t *p) {
+	parser_result_t result = parser_lex(p);
+	if (result.err == PARSER_OK)
+		result = parser_cross_ref(p, p->pending, p->prog.size);
+
+	if (result.err == PARSER_OK)
+		result = parser_link(p, p->pending, &p->prog.size);
+
+	if (result.err == PARSER_OK)
+		result = parser_optimize(p, p->pending, &p->prog.size);
+
+	if (result.err == PARSER_ERR_EXPECTED_END)
+		return result;
+	else if (result.err != PARSER_OK) {
+		parser_rollback(p, p->pending);
+		return result;
+	}
+
+	p->pending   = p->prog.size;
+	p->prog.vars = p->vars_count;
+	result.prog  = p->prog;
+	return result;
+}
+
+parser_result_t parser_lex_module(parser_t *p) {
+	p->module = true;
+	return parser_lex(p);
+}
+
+uint64_t parser_hash(parser_t *p) {
+	uint64_t hash = hash_bytes(p->in, p->len);
+	for (size_t i = 0; i < p->modules_count; ++ i)
+		hash = (hash ^ p->modules[i].m->hash) * 1099511628211ULL;
+
+	return hash;
+}
+
+void parser_discard_pending(parser_t *p) {
+	parser_rollback(p, p->pending);
+}
+
+/* Index right after the last pending instruction that closes every open block */
+static size_t parser_last_closed(parser_t *p) {
+	size_t nest = 0, last = p->pending;
+	for (size_t i = p->pending; i < p->prog.size; ++ i) {
+		switch (p->prog.ems[i].type) {
+		case EM_PRINT_BEGIN: case EM_IF_BEGIN: case EM_LOOP_BEGIN: case EM_SPAWN_BEGIN:
+		case EM_TASK_BEGIN: case EM_DEF_BEGIN:
+			++ nest;
+			break;
+
+		case EM_PRINT_END: case EM_IF_END: case EM_LOOP_END: case EM_SPAWN_END:
+		case EM_TASK_END: case EM_DEF_END:
+			if (nest > 0)
+				-- nest;
+			break;
+
+		default: break;
+		}
+
+		if (nest == 0)
+			last = i + 1;
+	}
+
+	/* A string at the very end might be the name of a subroutine in the next input */
+	if (last == p->prog.size && last > p->pending) {
+		em_t *top = &p->prog.ems[last - 1];
+		if (top->type == EM_PUSH && top->data.type == DATA_STR)
+			-- last;
+	}
+
+	return last;
+}
+
+parser_result_t parser_parse_segment(parser_t *p, program_t *seg, bool last) {
+	*seg = (program_t){0};
+
+	parser_result_t result = parser_ok();
+	if (p->in != NULL)
+		result = parser_lex(p);
+
 	if (result.err != PARSER_OK)
 		return result;
 
-	result.prog = p->prog;
+	size_t end = last? p->prog.size : parser_last_closed(p);
+	result = parser_cross_ref(p, p->pending, end);
+	if (result.err == PARSER_OK)
+		result = parser_link(p, p->pending, &end);
+
+	if (result.err == PARSER_OK)
+		result = parser_optimize(p, p->pending, &end);
+
+	if (result.err != PARSER_OK || end == p->pending)
+		return result;
+
+	/* Move the finished instructions out, the segment always starts at the beginning of the
+	   program so the refs stay valid. Subroutine definitions stay at the beginning for the next
+	   segments to call, the segment gets copies of them */
+	*seg = program_new(end);
+	seg->vars = p->vars_count;
+	seg->src  = source_ref(p->src);
+
+	size_t kept = 0;
+	for (size_t i = 0; i < end; ++ i) {
+		if (p->prog.ems[i].type != EM_DEF_BEGIN) {
+			seg->ems[i] = p->prog.ems[i];
+			continue;
+		}
+
+		size_t def_end = p->prog.ems[i].ref;
+		for (; i <= def_end; ++ i) {
+			seg->ems[i]          = em_copy(&p->prog.ems[i]);
+			p->prog.ems[kept ++] = p->prog.ems[i];
+		}
+		-- i;
+	}
+	seg->size = end;
+
+	memmove(p->prog.ems + kept, p->prog.ems + end, (p->prog.size - end) * sizeof(em_t));
+	p->prog.size -= end - kept;
+	p->pending    = kept;
+
+	/* The kept definitions moved */
+	result = parser_cross_ref(p, 0, kept);
+	if (result.err == PARSER_OK)
+		result = parser_link(p, 0, &p->pending);
+
 	return result;
 }
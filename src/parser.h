@@ -6,9 +6,13 @@
 #include <assert.h>  /* assert */
 #include <ctype.h>   /* isspace, isdigit */
 #include <stdbool.h> /* bool, true, false */
+#include <sys/types.h> /* dev_t, ino_t */
+#include <sys/stat.h>  /* struct stat, stat */
 
 #include "em.h"
 #include "utils.h"
+#include "pool.h"
+#include "opt.h"
 
 typedef enum {
 	PARSER_OK = 0,
@@ -19,6 +23,12 @@ typedef enum {
 	PARSER_ERR_UNEXPECTED_END,
 	PARSER_ERR_ILLEGAL_PRINT_NEST,
 	PARSER_ERR_EXPECTED_END,
+	PARSER_ERR_EXPECTED_NAME,
+	PARSER_ERR_ILLEGAL_DEF_NEST,
+	PARSER_ERR_REDEFINED,
+	PARSER_ERR_UNKNOWN_SUBROUTINE,
+	PARSER_ERR_IMPORT,
+	PARSER_ERR_TOKEN_TOO_LONG,
 
 	PARSER_ERRS_COUNT,
 } parser_err_t;
@@ -35,32 +45,161 @@ typedef struct {
 	program_t prog;
 } parser_result_t;
 
-parser_result_t parser_ok(void);
-parser_result_t parser_err(parser_err_t err, const char *path, size_t row, size_t col);
+/* Points of parser_parse the program can be dumped at, the last one is after main applied a
+   profile */
+typedef enum {
+	PARSER_STAGE_LEX = 0,
+	PARSER_STAGE_CROSS_REF,
+	PARSER_STAGE_LINK,
+	PARSER_STAGE_UNROLL,
+	PARSER_STAGE_FUSE,
+	PARSER_STAGE_HOT,
+
+	PARSER_STAGES_COUNT,
+} parser_stage_t;
+
+const char *parser_stage_to_cstr(parser_stage_t stage);
+
+/* Returns PARSER_STAGES_COUNT if there is no such stage */
+parser_stage_t parser_stage_from_cstr(const char *str);
 
 #define PARSER_MAX_TOKEN_LENGTH 1024
 
+typedef enum {
+	TOKEN_INT = 0,
+	TOKEN_STR,     /* In quotes */
+	TOKEN_WORD,    /* Any other token that pushes itself as a string, like names */
+	TOKEN_KEYWORD,
+	TOKEN_IMPORT,
+	TOKEN_COMMENT, /* Runs up to the end of the line */
+	TOKEN_ERR,
+
+	TOKEN_KINDS_COUNT,
+} token_kind_t;
+
+const char *token_kind_to_cstr(token_kind_t kind);
+
+typedef struct {
+	token_kind_t kind;
+	em_type_t    type; /* Instruction a keyword makes, keywords that push a string make EM_PUSH */
+	parser_err_t err;  /* Why a TOKEN_ERR is one */
+
+	size_t off, len; /* Bytes of the input the token covers */
+} token_t;
+
+/* "PATH :+" imports the file at PATH */
+#define PARSER_IMPORT_KEYWORD ":+"
+
+/* Files at least this big are lexed in chunks on the thread pool */
+#ifndef PARSER_PARALLEL_MIN
+#	define PARSER_PARALLEL_MIN (1024 * 1024)
+#endif
+
+/* Smallest chunk a file is split into */
+#ifndef PARSER_CHUNK_MIN
+#	define PARSER_CHUNK_MIN (256 * 1024)
+#endif
+
+typedef struct module module_t; /* In module.h */
+
+/* An import in a module, expanded once the module itself is imported */
+typedef struct {
+	size_t at;   /* Index of the instruction it comes before */
+	size_t off;  /* Of the import keyword */
+	char  *path; /* Relative to the directory of the module, resolved when the module is imported */
+} import_t;
+
+/* A module a parser imported, its instructions begin at at */
+typedef struct {
+	module_t *m;
+	size_t    at;
+	char     *path; /* As it was opened, relative to the dir of the parser */
+} imported_t;
+
 typedef struct {
 	const char *path;
-	size_t      row, col;
+	source_t   *src;
+	int         dir; /* Relative imports of the main input are opened from here, -1 for the working
+	                    directory. Imports are relative to the file that imports them */
 
 	bool   from_file;
 	char  *in;
 	int    ch;
-	size_t pos;
-
-	char   tok[PARSER_MAX_TOKEN_LENGTH];
+	size_t pos, len, base; /* base is the offset of the loaded input in the source */
+
+	/* Set while lexing one chunk of a file, names are then taken and variables get their slots
+	   only once the chunks are joined */
+	bool chunk;
+
+	/* Set while lexing a module, variables then get their slots and imports are expanded only
+	   once the module is imported. The imports are kept here meanwhile */
+	bool      module;
+	import_t *imports;
+	size_t    imports_count, imports_cap;
+
+	/* Every module is imported into a program only once, even if it is imported again. The main
+	   input counts as imported already if it is a file, which parser_load_file sets and embedders
+	   that read the file themselves set too */
+	imported_t *modules;
+	size_t      modules_count, modules_cap;
+	bool        root_file;
+	dev_t       root_dev;
+	ino_t       root_ino;
+
+	char   tok[PARSER_MAX_TOKEN_LENGTH + 1];
 	size_t tok_len;
 
 	program_t prog;
+	size_t    pending; /* Index of the first instruction that is not cross-referenced yet */
+
+	/* Names of the variables, the index of a name is its slot. The table maps their hashes to
+	   slot + 1, 0 for an empty entry */
+	str_t **vars;
+	size_t  vars_count, vars_cap;
+	size_t *vars_table;
+	size_t  vars_table_cap;
+
+	/* How long the phases of parser_parse took, in seconds */
+	double lex_time, cross_ref_time;
+
+	/* parser_parse writes the program into stderr after the stages with their bit set, and adds
+	   what the optimizations did to the report if there is one */
+	uint32_t      dump;
+	opt_report_t *report;
 } parser_t;
 
+parser_result_t parser_ok (void);
+parser_result_t parser_err(parser_t *p, parser_err_t err, size_t off);
+
 parser_t *parser_new    (size_t prog_cap);
 void      parser_destroy(parser_t *p);
 
 void parser_load_mem (parser_t *p, const char *in);
 int  parser_load_file(parser_t *p, const char *path);
 
+/* Big files are split at newlines, no token can span one, and the chunks are lexed in parallel */
 parser_result_t parser_parse(parser_t *p);
 
+/* Parses the loaded input and appends it to the program, cross-referencing only the instructions
+   added since the last successful call. PARSER_ERR_EXPECTED_END means a block is still open and
+   the instructions are kept until more input closes it, any other error discards them */
+parser_result_t parser_parse_more     (parser_t *p);
+void            parser_discard_pending(parser_t *p);
+
+/* Only lexes the loaded input, for module.c */
+parser_result_t parser_lex_module(parser_t *p);
+
+/* Hash of the loaded input and the modules it imported, once parsed */
+uint64_t parser_hash(parser_t *p);
+
+/* Lexes the next token from *pos on in the len bytes of in, the same way the parser does but
+   without allocating, and moves *pos past it. Returns false once there are no tokens left. Lexing
+   goes on after an error, which is a TOKEN_ERR token. Tokens never cross newlines */
+bool parser_next_token(const char *in, size_t len, size_t *pos, token_t *tok);
+
+/* Parses the loaded input and moves every instruction up to the last point where all blocks are
+   closed into seg, so it can be ran while the rest of the input is still being read. If last is
+   set, everything left has to be closed. seg is empty if nothing was finished */
+parser_result_t parser_parse_segment(parser_t *p, program_t *seg, bool last);
+
 #endif
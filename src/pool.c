@@ -0,0 +1,129 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h> /* pthread_t, pthread_create, pthread_mutex_t, pthread_cond_t */
+#include <unistd.h>  /* sysconf, _SC_NPROCESSORS_ONLN */
+
+#include "pool.h"
+
+typedef struct batch batch_t;
+struct batch {
+	pool_job_t job;
+	void      *arg;
+	size_t     count, next, done;
+
+	batch_t *next_batch;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pthread_cond_t  work, finished;
+
+	batch_t *batches;
+	size_t   threads;
+} pool = {
+	.lock     = PTHREAD_MUTEX_INITIALIZER,
+	.work     = PTHREAD_COND_INITIALIZER,
+	.finished = PTHREAD_COND_INITIALIZER,
+};
+
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+
+/* Claims the next job of the first batch with jobs left, pool.lock must be held */
+static batch_t *pool_claim(size_t *idx) {
+	while (pool.batches != NULL) {
+		batch_t *batch = pool.batches;
+		if (batch->next < batch->count) {
+			*idx = batch->next ++;
+			return batch;
+		}
+
+		pool.batches = batch->next_batch;
+	}
+
+	return NULL;
+}
+
+static void pool_finish(batch_t *batch) {
+	pthread_mutex_lock(&pool.lock);
+	if (++ batch->done == batch->count)
+		pthread_cond_broadcast(&pool.finished);
+	pthread_mutex_unlock(&pool.lock);
+}
+
+static void *pool_worker(void *unused) {
+	(void)unused;
+
+	pthread_mutex_lock(&pool.lock);
+	while (true) {
+		size_t   idx;
+		batch_t *batch = pool_claim(&idx);
+		if (batch == NULL) {
+			pthread_cond_wait(&pool.work, &pool.lock);
+			continue;
+		}
+
+		pthread_mutex_unlock(&pool.lock);
+		batch->job(batch->arg, idx);
+		pool_finish(batch);
+		pthread_mutex_lock(&pool.lock);
+	}
+
+	return NULL;
+}
+
+static void pool_init(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	/* The thread that calls pool_run works too */
+	for (long i = 1; i < cpus; ++ i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, pool_worker, NULL) != 0)
+			break;
+
+		pthread_detach(thread);
+		++ pool.threads;
+	}
+}
+
+size_t pool_threads(void) {
+	pthread_once(&pool_once, pool_init);
+	return pool.threads + 1;
+}
+
+void pool_run(pool_job_t job, void *arg, size_t count) {
+	if (count == 0)
+		return;
+	else if (pool_threads() == 1 || count == 1) {
+		for (size_t i = 0; i < count; ++ i)
+			job(arg, i);
+
+		return;
+	}
+
+	batch_t batch = {.job = job, .arg = arg, .count = count};
+
+	pthread_mutex_lock(&pool.lock);
+	batch.next_batch = pool.batches;
+	pool.batches     = &batch;
+	pthread_cond_broadcast(&pool.work);
+
+	while (batch.next < batch.count) {
+		size_t idx = batch.next ++;
+		pthread_mutex_unlock(&pool.lock);
+		job(arg, idx);
+		pool_finish(&batch);
+		pthread_mutex_lock(&pool.lock);
+	}
+
+	/* The batch may still be in the queue if a worker did not get to unlink it */
+	for (batch_t **it = &pool.batches; *it != NULL; it = &(*it)->next_batch) {
+		if (*it == &batch) {
+			*it = batch.next_batch;
+			break;
+		}
+	}
+
+	while (batch.done < batch.count)
+		pthread_cond_wait(&pool.finished, &pool.lock);
+	pthread_mutex_unlock(&pool.lock);
+}
@@ -0,0 +1,17 @@
+#ifndef POOL_H_HEADER_GUARD
+#define POOL_H_HEADER_GUARD
+
+#include <stdlib.h>  /* size_t */
+#include <stdbool.h> /* bool, true, false */
+#include <assert.h>  /* assert */
+
+typedef void (*pool_job_t)(void *arg, size_t idx);
+
+/* Calls job(arg, idx) for every idx below count on the process-wide thread pool and returns when
+   all of them have finished. The calling thread runs jobs too, so calling this from inside a job
+   can not deadlock */
+void pool_run(pool_job_t job, void *arg, size_t count);
+
+size_t pool_threads(void);
+
+#endif
@@ -0,0 +1,118 @@
+#include "profile.h"
+
+static const char *profile_err_to_cstr_map[PROFILE_ERRS_COUNT] = {
+	[PROFILE_OK] = "Ok",
+
+	[PROFILE_ERR_OPEN]    = "Failed to open",
+	[PROFILE_ERR_FORMAT]  = "Malformed profile",
+	[PROFILE_ERR_VERSION] = "Unsupported profile version",
+	[PROFILE_ERR_STALE]   = "Recorded from a different program",
+};
+
+const char *profile_err_to_cstr(profile_err_t err) {
+	assert(err < PROFILE_ERRS_COUNT && err >= 0);
+	return profile_err_to_cstr_map[err];
+}
+
+void profile_init(profile_t *profile, size_t size, uint64_t hash) {
+	assert(DATA_TYPES_COUNT <= 8);
+
+	ZERO_STRUCT(profile);
+	profile->hash  = hash;
+	profile->size  = size;
+	profile->ran   = (size_t*)alloc_malloc(ALLOC_PROFILE, (size + 1) * sizeof(size_t));
+	profile->taken = (size_t*)alloc_malloc(ALLOC_PROFILE, (size + 1) * sizeof(size_t));
+	profile->types = (uint8_t*)alloc_malloc(ALLOC_PROFILE, (size + 1) * sizeof(uint8_t));
+	assert(profile->ran != NULL && profile->taken != NULL && profile->types != NULL);
+
+	memset(profile->ran,   0, (size + 1) * sizeof(size_t));
+	memset(profile->taken, 0, (size + 1) * sizeof(size_t));
+	memset(profile->types, 0, (size + 1) * sizeof(uint8_t));
+}
+
+void profile_destroy(profile_t *profile) {
+	alloc_free(profile->ran);
+	alloc_free(profile->taken);
+	alloc_free(profile->types);
+}
+
+void profile_hit(profile_t *profile, size_t idx, data_t *top) {
+	assert(idx < profile->size);
+
+	++ profile->ran[idx];
+	if (top != NULL)
+		profile->types[idx] |= (uint8_t)(1 << top->type);
+}
+
+void profile_branch(profile_t *profile, size_t idx, bool taken) {
+	assert(idx < profile->size);
+	if (taken)
+		++ profile->taken[idx];
+}
+
+profile_err_t profile_save(profile_t *profile, program_t *prog, const char *path) {
+	assert(prog->size == profile->size);
+
+	FILE *file = fopen(path, "w");
+	if (file == NULL)
+		return PROFILE_ERR_OPEN;
+
+	fprintf(file, "emlang-profile %i\n", PROFILE_VERSION);
+	fprintf(file, "hash %016llx\n", (unsigned long long)profile->hash);
+	fprintf(file, "stack %zu\n", profile->stack_high);
+	fprintf(file, "ems %zu\n", profile->size);
+
+	for (size_t i = 0; i < profile->size; ++ i)
+		fprintf(file, "%zu %s %zu %zu %u\n", prog->ems[i].off, em_type_to_cstr(prog->ems[i].type),
+		        profile->ran[i], profile->taken[i], (unsigned)profile->types[i]);
+
+	fclose(file);
+	return PROFILE_OK;
+}
+
+static profile_err_t profile_read(profile_t *profile, program_t *prog, FILE *file,
+                                  uint64_t hash) {
+	int                version;
+	unsigned long long file_hash;
+	size_t             high, size;
+	if (fscanf(file, "emlang-profile %i\n", &version) != 1)
+		return PROFILE_ERR_FORMAT;
+	else if (version != PROFILE_VERSION)
+		return PROFILE_ERR_VERSION;
+	else if (fscanf(file, "hash %llx\nstack %zu\nems %zu\n", &file_hash, &high, &size) != 3)
+		return PROFILE_ERR_FORMAT;
+	else if ((uint64_t)file_hash != hash || size != prog->size)
+		return PROFILE_ERR_STALE;
+
+	profile_init(profile, size, hash);
+	profile->stack_high = high;
+
+	for (size_t i = 0; i < size; ++ i) {
+		char     type[32];
+		size_t   off;
+		unsigned types;
+		if (fscanf(file, "%zu %31s %zu %zu %u\n", &off, type, &profile->ran[i],
+		           &profile->taken[i], &types) != 5) {
+			profile_destroy(profile);
+			return PROFILE_ERR_FORMAT;
+		} else if (off != prog->ems[i].off ||
+		           strcmp(type, em_type_to_cstr(prog->ems[i].type)) != 0) {
+			profile_destroy(profile);
+			return PROFILE_ERR_STALE;
+		}
+
+		profile->types[i] = (uint8_t)types;
+	}
+
+	return PROFILE_OK;
+}
+
+profile_err_t profile_load(profile_t *profile, program_t *prog, const char *path, uint64_t hash) {
+	FILE *file = fopen(path, "r");
+	if (file == NULL)
+		return PROFILE_ERR_OPEN;
+
+	profile_err_t err = profile_read(profile, prog, file, hash);
+	fclose(file);
+	return err;
+}
@@ -0,0 +1,66 @@
+#ifndef PROFILE_H_HEADER_GUARD
+#define PROFILE_H_HEADER_GUARD
+
+#include <stdio.h>   /* FILE, fopen, fclose, fprintf, fscanf */
+#include <stdint.h>  /* uint8_t, uint64_t */
+#include <stdlib.h>  /* size_t */
+#include <string.h>  /* strcmp, memset */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "em.h"
+#include "data.h"
+
+/* Bumped whenever the format or the instructions the parser makes change */
+#define PROFILE_VERSION 1
+
+/* Instructions that ran at least this many times are hot */
+#ifndef PROFILE_HOT_COUNT
+#	define PROFILE_HOT_COUNT 1024
+#endif
+
+typedef enum {
+	PROFILE_OK = 0,
+
+	PROFILE_ERR_OPEN,
+	PROFILE_ERR_FORMAT,
+	PROFILE_ERR_VERSION,
+	PROFILE_ERR_STALE,
+
+	PROFILE_ERRS_COUNT,
+} profile_err_t;
+
+const char *profile_err_to_cstr(profile_err_t err);
+
+/* What a run of a program did, per instruction of the program. A profile is only good for the
+   program it was recorded from, so it is keyed to the hash of the source and every instruction in
+   it has to match the program it is loaded for. The file is text:
+
+     emlang-profile VERSION
+     hash HASH
+     stack HIGH
+     ems COUNT
+     OFF TYPE RAN TAKEN TYPES   (one line per instruction)
+
+   TAKEN is how many times an :/ or :@ went into its block, TYPES has bit N set if a value of data
+   type N was on top of the stack when the instruction ran */
+typedef struct {
+	uint64_t hash;
+	size_t   stack_high;
+
+	size_t   size;
+	size_t  *ran, *taken;
+	uint8_t *types;
+} profile_t;
+
+void profile_init   (profile_t *profile, size_t size, uint64_t hash);
+void profile_destroy(profile_t *profile);
+
+/* Called with the value on top of the stack, which can be NULL */
+void profile_hit   (profile_t *profile, size_t idx, data_t *top);
+void profile_branch(profile_t *profile, size_t idx, bool taken);
+
+profile_err_t profile_save(profile_t *profile, program_t *prog, const char *path);
+profile_err_t profile_load(profile_t *profile, program_t *prog, const char *path, uint64_t hash);
+
+#endif
@@ -0,0 +1,173 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <unistd.h>   /* read, close */
+#include <fcntl.h>    /* openat, O_RDONLY, AT_FDCWD */
+#include <errno.h>    /* errno, EINTR */
+#include <sys/stat.h> /* fstat, S_ISREG */
+#include <sys/mman.h> /* mmap, munmap, posix_madvise */
+
+#include "reader.h"
+
+reader_t *reader_new(int fd) {
+	reader_t *r = (reader_t*)malloc(sizeof(reader_t));
+	assert(r != NULL);
+
+	*r = (reader_t){.fd = fd, .cap = READER_BUF_CAP};
+	r->buf = (char*)malloc(r->cap);
+	assert(r->buf != NULL);
+	return r;
+}
+
+reader_t *reader_open(const char *path, int dir) {
+	int fd = openat(dir == -1? AT_FDCWD : dir, path, O_RDONLY);
+	if (fd == -1)
+		return NULL;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			posix_madvise(map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+			close(fd);
+
+			reader_t *r = (reader_t*)malloc(sizeof(reader_t));
+			assert(r != NULL);
+
+			*r = (reader_t){.fd = -1, .mapped = true, .eof = true, .buf = (char*)map};
+			r->size = r->cap = (size_t)st.st_size;
+			return r;
+		}
+	}
+
+	reader_t *r = reader_new(fd);
+	r->owns_fd  = true;
+	return r;
+}
+
+void reader_destroy(reader_t *r) {
+	assert(r != NULL);
+
+	if (r->mapped)
+		munmap(r->buf, r->cap);
+	else
+		free(r->buf);
+
+	if (r->owns_fd)
+		close(r->fd);
+
+	free(r);
+}
+
+/* Keeps the unread bytes and reads more after them, returns false if there is nothing more */
+static bool reader_fill(reader_t *r) {
+	if (r->eof)
+		return false;
+
+	if (r->pos > 0) {
+		memmove(r->buf, r->buf + r->pos, r->size - r->pos);
+		r->size -= r->pos;
+		r->pos   = 0;
+	}
+
+	if (r->size == r->cap) {
+		r->cap *= 2;
+		r->buf  = (char*)realloc(r->buf, r->cap);
+		assert(r->buf != NULL);
+	}
+
+	ssize_t got;
+	do
+		got = read(r->fd, r->buf + r->size, r->cap - r->size);
+	while (got == -1 && errno == EINTR);
+
+	if (got <= 0) {
+		r->eof = true;
+		return false;
+	}
+
+	r->size += (size_t)got;
+	return true;
+}
+
+#define READER_IS_SPACE(CH) ((CH) == ' ' || ((CH) >= '\t' && (CH) <= '\r'))
+
+reader_status_t reader_token(reader_t *r, const char **ret, size_t *len) {
+	while (true) {
+		while (r->pos < r->size && READER_IS_SPACE(r->buf[r->pos]))
+			++ r->pos;
+
+		if (r->pos < r->size)
+			break;
+		else if (!reader_fill(r))
+			return READER_EOF;
+	}
+
+	/* The token may continue past the end of the buffer, filling moves it to the start */
+	size_t end = r->pos;
+	while (true) {
+		while (end < r->size && !READER_IS_SPACE(r->buf[end]))
+			++ end;
+
+		if (end < r->size)
+			break;
+
+		size_t off = end - r->pos;
+		if (!reader_fill(r))
+			break;
+
+		end = r->pos + off;
+	}
+
+	*ret   = r->buf + r->pos;
+	*len   = end - r->pos;
+	r->pos = end;
+	return READER_OK;
+}
+
+reader_status_t reader_int(reader_t *r, int64_t *ret) {
+	const char *tok;
+	size_t      len;
+	if (reader_token(r, &tok, &len) != READER_OK)
+		return READER_EOF;
+
+	bool   neg = tok[0] == '-';
+	size_t i   = neg? 1 : 0;
+	if (i == len)
+		return READER_INVALID;
+
+	/* Numbers that do not fit are as invalid as anything else that is not a number */
+	uint64_t val = 0, max = neg? (uint64_t)INT64_MAX + 1 : (uint64_t)INT64_MAX;
+	for (; i < len; ++ i) {
+		unsigned digit = (unsigned char)tok[i] - '0';
+		if (digit > 9 || val > (max - digit) / 10)
+			return READER_INVALID;
+
+		val = val * 10 + digit;
+	}
+
+	*ret = (int64_t)(neg? 0 - val : val);
+	return READER_OK;
+}
+
+reader_status_t reader_line(reader_t *r, const char **ret, size_t *len) {
+	if (r->pos == r->size && !reader_fill(r))
+		return READER_EOF;
+
+	size_t off = 0;
+	char  *nl;
+	while ((nl = (char*)memchr(r->buf + r->pos + off, '\n', r->size - r->pos - off)) == NULL) {
+		off = r->size - r->pos;
+		if (!reader_fill(r))
+			break;
+	}
+
+	*ret = r->buf + r->pos;
+	if (nl == NULL) {
+		*len   = r->size - r->pos;
+		r->pos = r->size;
+	} else {
+		*len   = (size_t)(nl - *ret);
+		r->pos = *len + r->pos + 1;
+	}
+	return READER_OK;
+}
@@ -0,0 +1,38 @@
+#ifndef READER_H_HEADER_GUARD
+#define READER_H_HEADER_GUARD
+
+#include <stdint.h>  /* int64_t, uint64_t, INT64_MAX */
+#include <stdlib.h>  /* malloc, realloc, free, size_t */
+#include <string.h>  /* memmove, memchr */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#define READER_BUF_CAP (1024 * 1024)
+
+typedef enum {
+	READER_OK = 0,
+	READER_EOF,
+	READER_INVALID,
+} reader_status_t;
+
+/* Input source for the read instructions. Regular files are mapped into memory whole, anything
+   else is read through a large buffer. The strings returned by the reads point into the reader
+   and stay valid only until the next read. Relative paths are opened from dir, or from the working
+   directory if it is -1 */
+typedef struct {
+	int  fd;
+	bool mapped, eof, owns_fd;
+
+	char  *buf;
+	size_t cap, size, pos;
+} reader_t;
+
+reader_t *reader_new    (int fd);
+reader_t *reader_open   (const char *path, int dir);
+void      reader_destroy(reader_t *r);
+
+reader_status_t reader_int  (reader_t *r, int64_t *ret);
+reader_status_t reader_token(reader_t *r, const char **ret, size_t *len);
+reader_status_t reader_line (reader_t *r, const char **ret, size_t *len);
+
+#endif
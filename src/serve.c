@@ -0,0 +1,622 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h>    /* pthread_t, pthread_create, pthread_detach, pthread_mutex_t */
+#include <unistd.h>     /* read, write, close, unlink, STDIN_FILENO */
+#include <fcntl.h>      /* open, openat, O_RDONLY, O_DIRECTORY */
+#include <errno.h>      /* errno, EINTR */
+#include <sys/stat.h>   /* fstat */
+#include <sys/socket.h> /* socket, bind, listen, accept, connect, sendmsg, recvmsg */
+#include <sys/un.h>     /* sockaddr_un */
+
+#include "serve.h"
+
+#define SERVE_MAGIC 0x316c6d65 /* "eml1" */
+
+/* Sent along with the stdin, stdout, stderr and working directory of the client, followed by the
+   path or source of the program. The server answers with the exit code as an int32_t */
+typedef struct {
+	uint32_t magic, flags;
+	uint64_t size;
+} serve_request_t;
+
+enum {
+	SERVE_FD_IN = 0,
+	SERVE_FD_OUT,
+	SERVE_FD_ERR,
+	SERVE_FD_DIR,
+
+	SERVE_FDS_COUNT,
+};
+
+/* A module and the path the program imported it by, relative to the directory of the client */
+typedef struct {
+	module_t *m;
+	char     *path;
+} dep_t;
+
+typedef struct cached cached_t;
+struct cached {
+	char           *path;
+	uint64_t        hash;
+	struct timespec mtime;
+
+	program_t prog;
+	size_t    refs; /* One for being in the cache, and one for every request running it */
+
+	/* Modules the program imported, a program is parsed again once any of them changed */
+	dep_t *deps;
+	size_t deps_count;
+
+	cached_t *prev, *next;
+};
+
+/* Least recently used programs are at the tail */
+static struct {
+	pthread_mutex_t lock;
+
+	cached_t *head, *tail;
+	size_t    size;
+
+	int          fd;
+	env_limits_t limits;
+} server = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static bool serve_read_all(int fd, void *buf, size_t size) {
+	for (size_t got = 0; got < size;) {
+		ssize_t n = read(fd, (char*)buf + got, size - got);
+		if (n == -1 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			return false;
+
+		got += (size_t)n;
+	}
+
+	return true;
+}
+
+static bool serve_write_all(int fd, const void *buf, size_t size) {
+	for (size_t put = 0; put < size;) {
+		ssize_t n = write(fd, (const char*)buf + put, size - put);
+		if (n == -1 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			return false;
+
+		put += (size_t)n;
+	}
+
+	return true;
+}
+
+/* Cache lock has to be held by the callers of the cache_* functions */
+static void cache_unlink(cached_t *c) {
+	if (c->prev != NULL)
+		c->prev->next = c->next;
+	else
+		server.head = c->next;
+
+	if (c->next != NULL)
+		c->next->prev = c->prev;
+	else
+		server.tail = c->prev;
+
+	c->prev = c->next = NULL;
+	-- server.size;
+}
+
+static void cache_push_front(cached_t *c) {
+	c->prev = NULL;
+	c->next = server.head;
+	if (server.head != NULL)
+		server.head->prev = c;
+	else
+		server.tail = c;
+
+	server.head = c;
+	++ server.size;
+}
+
+/* Returns true if that was the last reference */
+static bool cache_unref(cached_t *c) {
+	assert(c->refs > 0);
+	return -- c->refs == 0;
+}
+
+static void cached_destroy(cached_t *c) {
+	for (size_t i = 0; i < c->deps_count; ++ i) {
+		module_release(c->deps[i].m);
+		free(c->deps[i].path);
+	}
+
+	free(c->deps);
+	program_destroy(&c->prog);
+	free(c->path);
+	free(c);
+}
+
+static bool cached_matches(cached_t *c, const char *path, uint64_t hash, struct timespec mtime) {
+	return c->hash == hash && c->mtime.tv_sec == mtime.tv_sec &&
+	       c->mtime.tv_nsec == mtime.tv_nsec && strcmp(c->path, path) == 0;
+}
+
+static bool cached_stale_deps(cached_t *c, int dir) {
+	for (size_t i = 0; i < c->deps_count; ++ i) {
+		if (module_stale(c->deps[i].m, dir, c->deps[i].path))
+			return true;
+	}
+
+	return false;
+}
+
+/* Imports are relative to the directory of the client */
+static cached_t *serve_cache_get(const char *path, uint64_t hash, struct timespec mtime, int dir) {
+	pthread_mutex_lock(&server.lock);
+	for (cached_t *c = server.head; c != NULL; c = c->next) {
+		if (cached_matches(c, path, hash, mtime) && !cached_stale_deps(c, dir)) {
+			cache_unlink(c);
+			cache_push_front(c);
+			++ c->refs;
+
+			pthread_mutex_unlock(&server.lock);
+			return c;
+		}
+	}
+
+	pthread_mutex_unlock(&server.lock);
+	return NULL;
+}
+
+/* A module that changed is a different module */
+static bool cached_same_deps(cached_t *a, cached_t *b) {
+	if (a->deps_count != b->deps_count)
+		return false;
+
+	for (size_t i = 0; i < a->deps_count; ++ i) {
+		if (a->deps[i].m != b->deps[i].m)
+			return false;
+	}
+
+	return true;
+}
+
+/* Adds a freshly parsed program and returns it with a reference for the caller. Older versions of
+   the same file are dropped. If another request parsed the same program in the meantime, that one
+   is returned instead */
+static cached_t *serve_cache_put(cached_t *c) {
+	cached_t *drop[SERVE_CACHE_CAP + 1];
+	size_t    drops = 0;
+
+	pthread_mutex_lock(&server.lock);
+	for (cached_t *it = server.head, *next; it != NULL; it = next) {
+		next = it->next;
+		if (cached_matches(it, c->path, c->hash, c->mtime) && cached_same_deps(it, c)) {
+			++ it->refs;
+			drop[drops ++] = c;
+			c = it;
+			break;
+		} else if (strcmp(it->path, c->path) == 0) {
+			cache_unlink(it);
+			if (cache_unref(it))
+				drop[drops ++] = it;
+		}
+	}
+
+	if (c->refs == 0) {
+		c->refs = 2;
+		cache_push_front(c);
+
+		if (server.size > SERVE_CACHE_CAP) {
+			cached_t *old = server.tail;
+			cache_unlink(old);
+			if (cache_unref(old))
+				drop[drops ++] = old;
+		}
+	}
+	pthread_mutex_unlock(&server.lock);
+
+	for (size_t i = 0; i < drops; ++ i)
+		cached_destroy(drop[i]);
+
+	return c;
+}
+
+static void serve_cache_release(cached_t *c) {
+	pthread_mutex_lock(&server.lock);
+	bool last = cache_unref(c);
+	pthread_mutex_unlock(&server.lock);
+
+	if (last)
+		cached_destroy(c);
+}
+
+static char *serve_read_file(int fd, size_t *size) {
+	size_t cap = 4096;
+	char  *buf = (char*)malloc(cap + 1);
+	assert(buf != NULL);
+
+	*size = 0;
+	while (true) {
+		if (*size == cap) {
+			cap *= 2;
+			buf  = (char*)realloc(buf, cap + 1);
+			assert(buf != NULL);
+		}
+
+		ssize_t n = read(fd, buf + *size, cap - *size);
+		if (n == -1 && errno == EINTR)
+			continue;
+		else if (n <= 0)
+			break;
+
+		*size += (size_t)n;
+	}
+
+	buf[*size] = '\0';
+	return buf;
+}
+
+/* Finds the program of a request in the cache, or parses it. Errors are reported to the client */
+static cached_t *serve_load(serve_request_t *req, char *payload, int dir, FILE *err) {
+	const char     *path  = payload;
+	char           *src   = payload;
+	size_t          size  = (size_t)req->size;
+	struct timespec mtime = {0};
+	struct stat     st;
+	bool            from_file = false;
+	if (req->flags & SERVE_SOURCE)
+		path = "<stdin>";
+	else {
+		int fd = openat(dir, path, O_RDONLY);
+		if (fd == -1) {
+			fprintf(err, "Error: Failed to open file '%s'\n", path);
+			return NULL;
+		}
+
+		from_file = fstat(fd, &st) == 0;
+		if (from_file)
+			mtime = st.st_mtim;
+
+		src = serve_read_file(fd, &size);
+		close(fd);
+	}
+
+	uint64_t  hash = hash_bytes(src, size);
+	cached_t *c    = serve_cache_get(path, hash, mtime, dir);
+	if (c == NULL) {
+		c = (cached_t*)malloc(sizeof(cached_t));
+		assert(c != NULL);
+		ZERO_STRUCT(c);
+
+		c->path  = (char*)malloc(strlen(path) + 1);
+		c->hash  = hash;
+		c->mtime = mtime;
+		assert(c->path != NULL);
+		strcpy(c->path, path);
+
+		parser_t *p = parser_new(DEFAULT_PROGRAM_CAP);
+		p->path     = c->path;
+		p->dir      = dir;
+		if (from_file) {
+			p->root_file = true;
+			p->root_dev  = st.st_dev;
+			p->root_ino  = st.st_ino;
+		}
+
+		parser_load_mem(p, src);
+
+		parser_result_t result = parser_parse(p);
+		if (result.err != PARSER_OK) {
+			fprintf(err, "Error at %s:%zu:%zu: %s\n",
+			        result.path, result.row, result.col, parser_err_to_cstr(result.err));
+
+			program_destroy(&p->prog);
+			free(c->path);
+			free(c);
+			c = NULL;
+		} else {
+			c->prog = result.prog;
+			if (p->modules_count > 0) {
+				c->deps = (dep_t*)malloc(p->modules_count * sizeof(dep_t));
+				assert(c->deps != NULL);
+
+				for (size_t i = 0; i < p->modules_count; ++ i) {
+					dep_t *dep = &c->deps[c->deps_count ++];
+					dep->m    = module_ref(p->modules[i].m);
+					dep->path = (char*)malloc(strlen(p->modules[i].path) + 1);
+					assert(dep->path != NULL);
+					strcpy(dep->path, p->modules[i].path);
+				}
+			}
+
+			c = serve_cache_put(c);
+		}
+
+		parser_destroy(p);
+	}
+
+	if (src != payload)
+		free(src);
+
+	return c;
+}
+
+static int serve_exec(env_t *e, serve_request_t *req, char *payload, int *fds, FILE *out,
+                      FILE *err) {
+	cached_t *c = serve_load(req, payload, fds[SERVE_FD_DIR], err);
+	if (c == NULL)
+		return EXIT_FAILURE;
+
+	/* The source of the program came from stdin */
+	e->no_stdin = req->flags & SERVE_SOURCE;
+	e->in_fd    = fds[SERVE_FD_IN];
+	e->out      = out;
+	e->err      = err;
+	e->dir      = fds[SERVE_FD_DIR];
+
+	stats_t st;
+	if (req->flags & SERVE_STATS) {
+		stats_init(&st);
+		e->stats = &st;
+		e->stack.high = e->stack.reallocs = 0;
+		stats_perf_start(&st);
+	}
+
+	runtime_result_t result = env_run(e, &c->prog);
+
+	if (req->flags & SERVE_STATS) {
+		stats_perf_stop(&st);
+		st.ticks          = e->tick;
+		st.stack_high     = e->stack.high;
+		st.stack_reallocs = e->stack.reallocs;
+
+		fflush(out);
+		stats_fprintf(&st, req->flags & SERVE_STATS_JSON? STATS_JSON : STATS_TEXT, err);
+		stats_destroy(&st);
+		e->stats = NULL;
+	}
+
+	int ex = (int)result.ex;
+	if (result.err != RUNTIME_OK) {
+		location_t loc = program_locate(&c->prog, result.em);
+		fprintf(err, "Error at %s:%zu:%zu: %s\n",
+		        loc.path, loc.row, loc.col, runtime_err_to_cstr(result.err));
+
+		env_unload(e);
+		ex = EXIT_FAILURE;
+	}
+
+	/* The env is kept for the next request */
+	if (e->in != NULL) {
+		reader_destroy(e->in);
+		e->in = NULL;
+	}
+
+	e->in_fd = STDIN_FILENO;
+	e->out   = stdout;
+	e->err   = stderr;
+	e->dir   = -1;
+
+	serve_cache_release(c);
+	return ex;
+}
+
+static bool serve_recv(int conn, serve_request_t *req, int *fds, char **payload) {
+	char ctrl[CMSG_SPACE(sizeof(int) * SERVE_FDS_COUNT)];
+	memset(ctrl, 0, sizeof(ctrl));
+
+	struct iovec  iov = {.iov_base = req, .iov_len = sizeof(*req)};
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = ctrl,
+		.msg_controllen = sizeof(ctrl),
+	};
+
+	ssize_t got;
+	do
+		got = recvmsg(conn, &msg, 0);
+	while (got == -1 && errno == EINTR);
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg != NULL && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+	    cmsg->cmsg_len == CMSG_LEN(sizeof(int) * SERVE_FDS_COUNT))
+		memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * SERVE_FDS_COUNT);
+
+	if (got <= 0 || fds[SERVE_FD_IN] == -1)
+		return false;
+	else if ((size_t)got < sizeof(*req) &&
+	         !serve_read_all(conn, (char*)req + got, sizeof(*req) - (size_t)got))
+		return false;
+	else if (req->magic != SERVE_MAGIC)
+		return false;
+
+	*payload = (char*)malloc((size_t)req->size + 1);
+	if (*payload == NULL)
+		return false;
+
+	(*payload)[req->size] = '\0';
+	return serve_read_all(conn, *payload, (size_t)req->size);
+}
+
+static void serve_handle(env_t *e, int conn) {
+	serve_request_t req;
+	int   fds[SERVE_FDS_COUNT] = {-1, -1, -1, -1};
+	char *payload = NULL;
+
+	FILE *out = NULL, *err = NULL;
+	if (serve_recv(conn, &req, fds, &payload)) {
+		out = fdopen(fds[SERVE_FD_OUT], "w");
+		err = fdopen(fds[SERVE_FD_ERR], "w");
+	}
+
+	if (out != NULL && err != NULL) {
+		int32_t ex = serve_exec(e, &req, payload, fds, out, err);
+
+		/* Everything has to reach the client before it exits */
+		fflush(out);
+		fflush(err);
+		serve_write_all(conn, &ex, sizeof(ex));
+	}
+
+	if (out != NULL)
+		fclose(out);
+	else if (fds[SERVE_FD_OUT] != -1)
+		close(fds[SERVE_FD_OUT]);
+
+	if (err != NULL)
+		fclose(err);
+	else if (fds[SERVE_FD_ERR] != -1)
+		close(fds[SERVE_FD_ERR]);
+
+	if (fds[SERVE_FD_IN] != -1)
+		close(fds[SERVE_FD_IN]);
+
+	if (fds[SERVE_FD_DIR] != -1)
+		close(fds[SERVE_FD_DIR]);
+
+	free(payload);
+}
+
+/* Every worker keeps its own env between requests */
+static void *serve_worker(void *unused) {
+	(void)unused;
+
+	env_t *e = env_new(DEFAULT_STACK_CAP);
+	e->limits = server.limits;
+	while (true) {
+		int conn = accept(server.fd, NULL, NULL);
+		if (conn == -1) {
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			break;
+		}
+
+		serve_handle(e, conn);
+		close(conn);
+	}
+
+	env_destroy(e);
+	return NULL;
+}
+
+int serve_run(const char *path, env_limits_t limits) {
+	server.limits = limits;
+
+	struct sockaddr_un addr;
+	ZERO_STRUCT(&addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: Socket path '%s' is too long\n", path);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, path);
+
+	server.fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (server.fd == -1) {
+		fprintf(stderr, "Error: Failed to create a socket\n");
+		return EXIT_FAILURE;
+	}
+
+	unlink(path);
+	if (bind(server.fd, (struct sockaddr*)&addr, sizeof(addr)) != 0 ||
+	    listen(server.fd, SOMAXCONN) != 0) {
+		fprintf(stderr, "Error: Failed to listen on '%s'\n", path);
+		close(server.fd);
+		return EXIT_FAILURE;
+	}
+
+	/* A client going away while its program prints should not take the server down with it */
+	ignore_sigpipe();
+
+	for (size_t i = 1; i < pool_threads(); ++ i) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, serve_worker, NULL) != 0)
+			break;
+
+		pthread_detach(thread);
+	}
+
+	serve_worker(NULL);
+
+	fprintf(stderr, "Error: Failed to accept a connection on '%s'\n", path);
+	close(server.fd);
+	return EXIT_FAILURE;
+}
+
+int serve_client(const char *sock, const char *path, uint32_t flags) {
+	struct sockaddr_un addr;
+	ZERO_STRUCT(&addr);
+	addr.sun_family = AF_UNIX;
+	if (strlen(sock) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "Error: Socket path '%s' is too long\n", sock);
+		return EXIT_FAILURE;
+	}
+	strcpy(addr.sun_path, sock);
+
+	int conn = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn == -1 || connect(conn, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Error: Failed to connect to '%s'\n", sock);
+		return EXIT_FAILURE;
+	}
+
+	char  *payload = (char*)path;
+	size_t size    = strlen(path);
+	if (strcmp(path, "-") == 0) {
+		payload = serve_read_file(STDIN_FILENO, &size);
+		flags  |= SERVE_SOURCE;
+	}
+
+	int fds[SERVE_FDS_COUNT] = {
+		[SERVE_FD_IN]  = STDIN_FILENO,
+		[SERVE_FD_OUT] = STDOUT_FILENO,
+		[SERVE_FD_ERR] = STDERR_FILENO,
+		[SERVE_FD_DIR] = open(".", O_RDONLY | O_DIRECTORY),
+	};
+
+	int ex = EXIT_FAILURE;
+	if (fds[SERVE_FD_DIR] == -1) {
+		fprintf(stderr, "Error: Failed to open the working directory\n");
+		goto out;
+	}
+
+	serve_request_t req = {.magic = SERVE_MAGIC, .flags = flags, .size = size};
+	char ctrl[CMSG_SPACE(sizeof(fds))];
+	memset(ctrl, 0, sizeof(ctrl));
+
+	struct iovec  iov = {.iov_base = &req, .iov_len = sizeof(req)};
+	struct msghdr msg = {
+		.msg_iov        = &iov,
+		.msg_iovlen     = 1,
+		.msg_control    = ctrl,
+		.msg_controllen = sizeof(ctrl),
+	};
+
+	struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type  = SCM_RIGHTS;
+	cmsg->cmsg_len   = CMSG_LEN(sizeof(fds));
+	memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+	int32_t reply;
+	if (sendmsg(conn, &msg, 0) != (ssize_t)sizeof(req) || !serve_write_all(conn, payload, size) ||
+	    !serve_read_all(conn, &reply, sizeof(reply))) {
+		fprintf(stderr, "Error: Lost the connection to '%s'\n", sock);
+		goto out;
+	}
+
+	ex = reply;
+
+out:
+	if (fds[SERVE_FD_DIR] != -1)
+		close(fds[SERVE_FD_DIR]);
+
+	if (payload != path)
+		free(payload);
+
+	close(conn);
+	return ex;
+}
@@ -0,0 +1,39 @@
+#ifndef SERVE_H_HEADER_GUARD
+#define SERVE_H_HEADER_GUARD
+
+#include <stdio.h>   /* fprintf, fdopen, fclose */
+#include <stdlib.h>  /* malloc, realloc, free, EXIT_FAILURE */
+#include <stdint.h>  /* uint32_t, uint64_t, int32_t */
+#include <string.h>  /* memcpy, memset, strcmp, strlen */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "parser.h"
+#include "module.h"
+#include "env.h"
+#include "pool.h"
+#include "stats.h"
+
+/* How many parsed programs the server keeps around */
+#ifndef SERVE_CACHE_CAP
+#	define SERVE_CACHE_CAP 64
+#endif
+
+typedef enum {
+	SERVE_SOURCE     = 1 << 0, /* The request carries the source of the program, not its path */
+	SERVE_STATS      = 1 << 1,
+	SERVE_STATS_JSON = 1 << 2,
+} serve_flag_t;
+
+/* Listens on a Unix domain socket at path and runs the programs that clients send on one worker
+   per thread of the pool. Parsed programs are cached by their path, modification time and content
+   hash. Clients pass their stdin, stdout, stderr and working directory along with the request, so
+   the program behaves as if the client ran it. Every program runs with the limits of the server.
+   Only returns on failure */
+int serve_run(const char *path, env_limits_t limits);
+
+/* Runs the program at path, or the program read from stdin if path is "-", on the server
+   listening at sock. Returns the exit code of the program */
+int serve_client(const char *sock, const char *path, uint32_t flags);
+
+#endif
@@ -0,0 +1,154 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h> /* pthread_mutex_t, pthread_mutex_lock, pthread_mutex_unlock */
+
+#include "source.h"
+
+struct source {
+	char *path;
+
+	/* The stream parser adds lines while the program it already sent runs */
+	pthread_mutex_t lock;
+
+	size_t *lines; /* Offsets of the first byte of every line */
+	size_t  lines_count, lines_cap;
+	size_t  len;   /* How many bytes of input were scanned */
+
+	/* Linked sources, one after another from SOURCE_LINKED on. Each holds a reference */
+	source_t **links;
+	size_t    *links_base;
+	size_t     links_count, links_cap, links_len;
+
+	size_t refs;
+};
+
+source_t *source_new(const char *path) {
+	source_t *src = (source_t*)alloc_malloc(ALLOC_SOURCE, sizeof(source_t));
+	assert(src != NULL);
+
+	src->path = (char*)alloc_malloc(ALLOC_SOURCE, strlen(path) + 1);
+	assert(src->path != NULL);
+	strcpy(src->path, path);
+
+	pthread_mutex_init(&src->lock, NULL);
+
+	src->lines_cap = 64;
+	src->lines     = (size_t*)alloc_malloc(ALLOC_SOURCE, src->lines_cap * sizeof(size_t));
+	assert(src->lines != NULL);
+
+	src->lines[0]    = 0;
+	src->lines_count = 1;
+	src->len         = 0;
+	src->links       = NULL;
+	src->links_base  = NULL;
+	src->links_count = 0;
+	src->links_cap   = 0;
+	src->links_len   = 0;
+	src->refs        = 1;
+	return src;
+}
+
+source_t *source_ref(source_t *src) {
+	__atomic_add_fetch(&src->refs, 1, __ATOMIC_RELAXED);
+	return src;
+}
+
+void source_release(source_t *src) {
+	if (__atomic_sub_fetch(&src->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	for (size_t i = 0; i < src->links_count; ++ i)
+		source_release(src->links[i]);
+
+	pthread_mutex_destroy(&src->lock);
+	alloc_free(src->links);
+	alloc_free(src->links_base);
+	alloc_free(src->lines);
+	alloc_free(src->path);
+	alloc_free(src);
+}
+
+/* memchr goes through many bytes at once, unlike the lexer */
+size_t source_scan(source_t *src, const char *text, size_t len) {
+	pthread_mutex_lock(&src->lock);
+
+	size_t base = src->len;
+	for (const char *it = text, *end = text + len;
+	     (it = (const char*)memchr(it, '\n', (size_t)(end - it))) != NULL; ++ it) {
+		if (src->lines_count >= src->lines_cap) {
+			src->lines_cap *= 2;
+			src->lines      = (size_t*)alloc_realloc(ALLOC_SOURCE, src->lines,
+			                                         src->lines_cap * sizeof(size_t));
+			assert(src->lines != NULL);
+		}
+
+		src->lines[src->lines_count ++] = base + (size_t)(it - text) + 1;
+	}
+
+	src->len += len;
+	pthread_mutex_unlock(&src->lock);
+	return base;
+}
+
+/* A linked source is never scanned again, so its length is final */
+size_t source_link(source_t *src, source_t *linked) {
+	pthread_mutex_lock(&src->lock);
+	if (src->links_count >= src->links_cap) {
+		src->links_cap  = src->links_cap == 0? 8 : src->links_cap * 2;
+		src->links      = (source_t**)alloc_realloc(ALLOC_SOURCE, src->links,
+		                                            src->links_cap * sizeof(source_t*));
+		src->links_base = (size_t*)alloc_realloc(ALLOC_SOURCE, src->links_base,
+		                                         src->links_cap * sizeof(size_t));
+		assert(src->links != NULL && src->links_base != NULL);
+	}
+
+	size_t base = src->links_len;
+	src->links     [src->links_count]   = source_ref(linked);
+	src->links_base[src->links_count ++] = base;
+
+	/* Empty sources still get a byte, so every link starts at a different offset */
+	src->links_len += linked->len > 0? linked->len : 1;
+	pthread_mutex_unlock(&src->lock);
+	return base;
+}
+
+size_t source_relocate(size_t base, size_t off) {
+	assert(off < SOURCE_LINKED);
+	return SOURCE_LINKED + base + off;
+}
+
+/* Rows and columns count from 1, a column is a byte */
+location_t source_locate(source_t *src, size_t off) {
+	pthread_mutex_lock(&src->lock);
+	if (off >= SOURCE_LINKED) {
+		/* Last link that begins at or before off */
+		size_t lo = 0, hi = src->links_count, rel = off - SOURCE_LINKED;
+		assert(hi > 0);
+		while (hi - lo > 1) {
+			size_t mid = lo + (hi - lo) / 2;
+			if (src->links_base[mid] <= rel)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		source_t *linked = src->links[lo];
+		rel -= src->links_base[lo];
+		pthread_mutex_unlock(&src->lock);
+		return source_locate(linked, rel);
+	}
+
+	/* Last line that begins at or before off */
+	size_t lo = 0, hi = src->lines_count;
+	while (hi - lo > 1) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (src->lines[mid] <= off)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	location_t loc = {.path = src->path, .row = lo + 1, .col = off - src->lines[lo] + 1};
+	pthread_mutex_unlock(&src->lock);
+	return loc;
+}
@@ -0,0 +1,41 @@
+#ifndef SOURCE_H_HEADER_GUARD
+#define SOURCE_H_HEADER_GUARD
+
+#include <stdlib.h>  /* size_t */
+#include <stdint.h>  /* SIZE_MAX */
+#include <string.h>  /* memchr, strlen, strcpy */
+#include <assert.h>  /* assert */
+
+#include "alloc.h"
+
+typedef struct {
+	const char *path;
+	size_t      row, col;
+} location_t;
+
+/* Where the lines of the input begin, so that instructions only have to store a byte offset and
+   locations are worked out when a diagnostic is printed. The input can come in pieces. Sources are
+   shared by reference between the parser and the programs made from it, which can be on different
+   threads while streaming */
+typedef struct source source_t;
+
+source_t *source_new    (const char *path);
+source_t *source_ref    (source_t *src);
+void      source_release(source_t *src);
+
+/* Adds the lines of the next len bytes of input. Returns the offset the text starts at */
+size_t source_scan(source_t *src, const char *text, size_t len);
+
+/* Offsets from here on are in the text of linked sources, which is kept apart from the input */
+#define SOURCE_LINKED ((SIZE_MAX >> 1) + 1)
+
+/* Makes the whole text of another source, like an imported file, part of this one. Returns the
+   base to pass to source_relocate for offsets into linked */
+size_t source_link(source_t *src, source_t *linked);
+
+/* Turns an offset into a linked source into an offset into the source it was linked to */
+size_t source_relocate(size_t base, size_t off);
+
+location_t source_locate(source_t *src, size_t off);
+
+#endif
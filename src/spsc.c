@@ -0,0 +1,80 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <sched.h> /* sched_yield */
+#include <time.h>  /* nanosleep */
+
+#include "spsc.h"
+
+void spsc_init(spsc_t *q, size_t cap) {
+	assert(cap > 0 && (cap & (cap - 1)) == 0);
+
+	*q = (spsc_t){.cap = cap};
+	q->slots = (void**)malloc(cap * sizeof(void*));
+	assert(q->slots != NULL);
+}
+
+void spsc_destroy(spsc_t *q) {
+	free(q->slots);
+}
+
+bool spsc_try_push(spsc_t *q, void *item) {
+	size_t tail = q->tail;
+	if (tail - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == q->cap)
+		return false;
+
+	q->slots[tail & (q->cap - 1)] = item;
+	__atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+bool spsc_try_pop(spsc_t *q, void **item) {
+	size_t head = q->head;
+	if (__atomic_load_n(&q->tail, __ATOMIC_ACQUIRE) == head)
+		return false;
+
+	*item = q->slots[head & (q->cap - 1)];
+	__atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+
+/* Spin first since the other side is usually about to make progress, then yield, then sleep so
+   a stalled other side does not burn a core */
+void spsc_backoff(size_t *tries) {
+	if (*tries < 64) {
+		++ *tries;
+		return;
+	} else if (*tries < 128) {
+		++ *tries;
+		sched_yield();
+		return;
+	}
+
+	struct timespec ts = {.tv_sec = 0, .tv_nsec = 50000};
+	nanosleep(&ts, NULL);
+}
+
+#define SPSC_STOPPED(STOP) ((STOP) != NULL && __atomic_load_n(STOP, __ATOMIC_ACQUIRE))
+
+bool spsc_push(spsc_t *q, void *item, const bool *stop) {
+	size_t tries = 0;
+	while (!spsc_try_push(q, item)) {
+		if (SPSC_STOPPED(stop))
+			return false;
+
+		spsc_backoff(&tries);
+	}
+
+	return true;
+}
+
+bool spsc_pop(spsc_t *q, void **item, const bool *stop) {
+	size_t tries = 0;
+	while (!spsc_try_pop(q, item)) {
+		if (SPSC_STOPPED(stop))
+			return false;
+
+		spsc_backoff(&tries);
+	}
+
+	return true;
+}
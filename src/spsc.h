@@ -0,0 +1,37 @@
+#ifndef SPSC_H_HEADER_GUARD
+#define SPSC_H_HEADER_GUARD
+
+#include <stdlib.h>  /* malloc, free, size_t */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#define SPSC_CACHE_LINE 64
+
+/* Bounded lock-free queue of pointers for exactly one producer and one consumer thread. The
+   indices only ever grow and are masked into the slots, so the capacity is a power of two */
+typedef struct {
+	void  **slots;
+	size_t  cap;
+
+	char   pad0[SPSC_CACHE_LINE];
+	size_t head; /* Written only by the consumer */
+	char   pad1[SPSC_CACHE_LINE];
+	size_t tail; /* Written only by the producer */
+	char   pad2[SPSC_CACHE_LINE];
+} spsc_t;
+
+void spsc_init   (spsc_t *q, size_t cap);
+void spsc_destroy(spsc_t *q);
+
+bool spsc_try_push(spsc_t *q, void  *item);
+bool spsc_try_pop (spsc_t *q, void **item);
+
+/* Blocking versions that back off while the queue is full or empty. If stop is not NULL and
+   becomes set while waiting, they give up and return false */
+bool spsc_push(spsc_t *q, void  *item, const bool *stop);
+bool spsc_pop (spsc_t *q, void **item, const bool *stop);
+
+/* How the blocking versions wait, tries starts at 0 and is reset once progress is made */
+void spsc_backoff(size_t *tries);
+
+#endif
@@ -1,43 +1,17 @@
 #include "stack.h"
 
-stack_t stack_new(size_t cap, size_t popped_cap) {
+stack_t stack_new(size_t cap) {
 	stack_t stack = {.cap = cap, .size = 0};
-	stack.buf = (data_t*)malloc(stack.cap * sizeof(*stack.buf));
+	stack.buf = (data_t*)alloc_malloc(ALLOC_STACK, stack.cap * sizeof(*stack.buf));
 	assert(stack.buf != NULL);
 
-	stack.popped_cap = popped_cap;
-	stack.popped     = (popped_t*)malloc(stack.popped_cap * sizeof(popped_t));
-	assert(stack.popped != NULL);
-
 	return stack;
 }
 
-static void stack_add_popped(stack_t *stack, char *str) {
-	assert(stack != NULL);
-
-	if (stack->popped_size >= stack->popped_cap) {
-		stack->popped_cap *= 2;
-		stack->popped      = (popped_t*)realloc(stack->popped,
-		                                        stack->popped_cap * sizeof(popped_t));
-		assert(stack->popped != NULL);
-	}
-
-	stack->popped[stack->popped_size ++] = (popped_t){.str = str, .marked = false};
-}
-
 void stack_destroy(stack_t *stack) {
 	assert(stack != NULL);
 
-	for (size_t i = 0; i < stack->size; ++ i) {
-		if (stack->buf[i].type != DATA_STR)
-			continue;
-
-		assert(stack->buf[i].as.str != NULL);
-		free(stack->buf[i].as.str);
-	}
-
-	free(stack->buf);
-	free(stack->popped);
+	alloc_free(stack->buf);
 }
 
 void stack_push(stack_t *stack, data_t data) {
@@ -45,11 +19,15 @@ void stack_push(stack_t *stack, data_t data) {
 
 	if (stack->size >= stack->cap) {
 		stack->cap *= 2;
-		stack->buf  = (data_t*)realloc(stack->buf, stack->cap * sizeof(*stack->buf));
+		stack->buf  = (data_t*)alloc_realloc(ALLOC_STACK, stack->buf,
+		                                     stack->cap * sizeof(*stack->buf));
 		assert(stack->buf != NULL);
+		++ stack->reallocs;
 	}
 
 	stack->buf[stack->size ++] = data;
+	if (stack->size > stack->high)
+		stack->high = stack->size;
 }
 
 int stack_pop(stack_t *stack, data_t *ret) {
@@ -58,9 +36,6 @@ int stack_pop(stack_t *stack, data_t *ret) {
 		return -1;
 
 	data_t data = stack->buf[-- stack->size];
-	if (data.type == DATA_STR)
-		stack_add_popped(stack, data.as.str);
-
 	if (ret != NULL)
 		*ret = data;
 	return 0;
@@ -88,48 +63,11 @@ int stack_swap(stack_t *stack, size_t off) {
 
 void stack_shrink_to(stack_t *stack, size_t size) {
 	assert(stack != NULL);
-	if (size == stack->size)
-		return;
-	else
-		assert(size < stack->size);
-
-	for (size_t i = size; i < stack->size; ++ i) {
-		if (stack->buf[i].type == DATA_STR) {
-			stack_add_popped(stack, stack->buf[i].as.str);
-		}
-	}
+	assert(size <= stack->size);
 
 	stack->size = size;
 }
 
 void stack_clear(stack_t *stack) {
 	stack_shrink_to(stack, 0);
-	stack_gc(stack);
-}
-
-void stack_gc(stack_t *stack) {
-#ifdef DEBUG
-	printf("\n[GARBAGE COLLECTING]\n");
-#endif
-
-	assert(stack != NULL);
-	if (stack->popped_size == 0)
-		return;
-
-	for (size_t i = 0; i < stack->size; ++ i) {
-		if (stack->buf[i].type != DATA_STR)
-			continue;
-
-		for (size_t i = 0; i < stack->popped_size; ++ i) {
-			if (stack->buf[i].as.str == stack->popped[i].str)
-				stack->popped[i].marked = true;
-		}
-	}
-
-	for (size_t i = 0; i < stack->popped_size; ++ i) {
-		if (!stack->popped[i].marked)
-			free(stack->popped[i].str);
-	}
-
-	stack->popped_size = 0;
 }
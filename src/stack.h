@@ -7,25 +7,18 @@
 
 #include "utils.h"
 #include "data.h"
-
-#define DEFAULT_POPPED_CAP 32
-
-typedef struct {
-	char *str;
-	bool  marked;
-} popped_t;
+#include "alloc.h"
 
 typedef struct {
 	data_t *buf;
 	size_t  cap, size;
 
-	popped_t *popped;
-	size_t    popped_cap, popped_size;
+	size_t high, reallocs;
 } stack_t;
 
 #define DEFAULT_STACK_CAP 1024
 
-stack_t stack_new(size_t cap, size_t popped_cap);
+stack_t stack_new(size_t cap);
 void    stack_destroy(stack_t *stack);
 
 void stack_push     (stack_t *stack, data_t  data);
@@ -35,6 +28,4 @@ int  stack_swap     (stack_t *stack, size_t off);
 void stack_shrink_to(stack_t *stack, size_t size);
 void stack_clear    (stack_t *stack);
 
-void stack_gc(stack_t *stack);
-
 #endif
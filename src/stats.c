@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+
+#include <unistd.h>              /* syscall, close, read */
+#include <sys/ioctl.h>           /* ioctl */
+#include <sys/syscall.h>         /* SYS_perf_event_open */
+#include <linux/perf_event.h>    /* perf_event_attr, PERF_* */
+
+#include "stats.h"
+
+static const char *stats_perf_to_cstr_map[STATS_PERF_COUNT] = {
+	[STATS_PERF_CYCLES]        = "cycles",
+	[STATS_PERF_INSTRUCTIONS]  = "instructions",
+	[STATS_PERF_BRANCH_MISSES] = "branch_misses",
+	[STATS_PERF_CACHE_MISSES]  = "cache_misses",
+};
+
+/* Only used for the labels of the text report */
+static const char *stats_perf_to_label_map[STATS_PERF_COUNT] = {
+	[STATS_PERF_CYCLES]        = "Cycles:",
+	[STATS_PERF_INSTRUCTIONS]  = "Instructions:",
+	[STATS_PERF_BRANCH_MISSES] = "Branch misses:",
+	[STATS_PERF_CACHE_MISSES]  = "Cache misses:",
+};
+
+static const uint64_t stats_perf_config_map[STATS_PERF_COUNT] = {
+	[STATS_PERF_CYCLES]        = PERF_COUNT_HW_CPU_CYCLES,
+	[STATS_PERF_INSTRUCTIONS]  = PERF_COUNT_HW_INSTRUCTIONS,
+	[STATS_PERF_BRANCH_MISSES] = PERF_COUNT_HW_BRANCH_MISSES,
+	[STATS_PERF_CACHE_MISSES]  = PERF_COUNT_HW_CACHE_MISSES,
+};
+
+void stats_init(stats_t *stats) {
+	ZERO_STRUCT(stats);
+
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.type           = PERF_TYPE_HARDWARE;
+		attr.size           = sizeof(attr);
+		attr.config         = stats_perf_config_map[i];
+		attr.disabled       = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv     = 1;
+
+		stats->perf_fds[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+}
+
+void stats_destroy(stats_t *stats) {
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		if (stats->perf_fds[i] != -1)
+			close(stats->perf_fds[i]);
+	}
+}
+
+void stats_perf_start(stats_t *stats) {
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		if (stats->perf_fds[i] == -1)
+			continue;
+
+		ioctl(stats->perf_fds[i], PERF_EVENT_IOC_RESET,  0);
+		ioctl(stats->perf_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+	}
+}
+
+void stats_perf_stop(stats_t *stats) {
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		if (stats->perf_fds[i] == -1)
+			continue;
+
+		ioctl(stats->perf_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+		if (read(stats->perf_fds[i], &stats->perf[i], sizeof(uint64_t)) != sizeof(uint64_t)) {
+			close(stats->perf_fds[i]);
+			stats->perf_fds[i] = -1;
+		}
+	}
+}
+
+void stats_add(stats_t *stats, stats_t *from) {
+	for (size_t i = 0; i < EM_TYPES_COUNT; ++ i)
+		stats->ems[i] += from->ems[i];
+
+	stats->gc_runs   += from->gc_runs;
+	stats->gc_resets += from->gc_resets;
+	stats->gc_freed  += from->gc_freed;
+}
+
+static void stats_fprintf_text(stats_t *stats, FILE *file) {
+	fprintf(file, "Executed instructions:\n");
+	for (size_t i = 0; i < EM_TYPES_COUNT; ++ i) {
+		if (stats->ems[i] == 0)
+			continue;
+
+		fprintf(file, "  %-14s %12zu  %5.1f%%\n", em_type_to_cstr((em_type_t)i), stats->ems[i],
+		        stats->ticks > 0? 100.0 * (double)stats->ems[i] / (double)stats->ticks : 0.0);
+	}
+
+	fprintf(file, "Ticks:                %zu\n", stats->ticks);
+	fprintf(file, "GC runs:              %zu\n", stats->gc_runs);
+	fprintf(file, "GC arena resets:      %zu\n", stats->gc_resets);
+	fprintf(file, "GC bytes freed:       %zu\n", stats->gc_freed);
+	fprintf(file, "Stack high-water:     %zu\n", stats->stack_high);
+	fprintf(file, "Stack reallocations:  %zu\n", stats->stack_reallocs);
+
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		fprintf(file, "%-22s", stats_perf_to_label_map[i]);
+		if (stats->perf_fds[i] == -1)
+			fprintf(file, "unavailable\n");
+		else
+			fprintf(file, "%llu\n", (unsigned long long)stats->perf[i]);
+	}
+}
+
+static void stats_fprintf_json(stats_t *stats, FILE *file) {
+	fprintf(file, "{\"ems\": {");
+	bool first = true;
+	for (size_t i = 0; i < EM_TYPES_COUNT; ++ i) {
+		if (stats->ems[i] == 0)
+			continue;
+
+		fprintf(file, "%s\"%s\": %zu", first? "" : ", ", em_type_to_cstr((em_type_t)i),
+		        stats->ems[i]);
+		first = false;
+	}
+
+	fprintf(file, "}, \"ticks\": %zu, \"gc_runs\": %zu, \"gc_resets\": %zu, \"gc_freed\": %zu, "
+	        "\"stack_high\": %zu, \"stack_reallocs\": %zu, \"perf\": {",
+	        stats->ticks, stats->gc_runs, stats->gc_resets, stats->gc_freed,
+	        stats->stack_high, stats->stack_reallocs);
+
+	for (size_t i = 0; i < STATS_PERF_COUNT; ++ i) {
+		fprintf(file, "%s\"%s\": ", i > 0? ", " : "", stats_perf_to_cstr_map[i]);
+		if (stats->perf_fds[i] == -1)
+			fprintf(file, "null");
+		else
+			fprintf(file, "%llu", (unsigned long long)stats->perf[i]);
+	}
+
+	fprintf(file, "}}\n");
+}
+
+void stats_fprintf(stats_t *stats, stats_format_t format, FILE *file) {
+	switch (format) {
+	case STATS_TEXT: stats_fprintf_text(stats, file); break;
+	case STATS_JSON: stats_fprintf_json(stats, file); break;
+
+	default: assert(0);
+	}
+}
@@ -0,0 +1,49 @@
+#ifndef STATS_H_HEADER_GUARD
+#define STATS_H_HEADER_GUARD
+
+#include <stdio.h>   /* fprintf */
+#include <stdint.h>  /* uint64_t */
+#include <string.h>  /* memset */
+#include <stdbool.h> /* bool, true, false */
+
+#include "em.h"
+
+typedef enum {
+	STATS_TEXT = 0,
+	STATS_JSON,
+} stats_format_t;
+
+typedef enum {
+	STATS_PERF_CYCLES = 0,
+	STATS_PERF_INSTRUCTIONS,
+	STATS_PERF_BRANCH_MISSES,
+	STATS_PERF_CACHE_MISSES,
+
+	STATS_PERF_COUNT,
+} stats_perf_t;
+
+typedef struct {
+	size_t ems[EM_TYPES_COUNT];
+	size_t ticks;
+
+	size_t gc_runs, gc_resets, gc_freed;
+	size_t stack_high, stack_reallocs;
+
+	/* Hardware counters, each is only reported if the kernel let us open it */
+	int      perf_fds[STATS_PERF_COUNT];
+	uint64_t perf    [STATS_PERF_COUNT];
+} stats_t;
+
+void stats_init   (stats_t *stats);
+void stats_destroy(stats_t *stats);
+
+void stats_perf_start(stats_t *stats);
+void stats_perf_stop (stats_t *stats);
+
+/* Adds the instructions and the GC work counted in from, for spawn workers that count into stats
+   of their own. The ticks, the stack and the hardware counters are left alone */
+void stats_add(stats_t *stats, stats_t *from);
+
+void stats_fprintf(stats_t *stats, stats_format_t format, FILE *file);
+
+#endif
@@ -0,0 +1,70 @@
+#include "str.h"
+
+#define STR_MIN_CAP 16
+
+str_t *str_new_lit(const char *text, size_t len) {
+	str_t *str = (str_t*)alloc_malloc(ALLOC_LITERAL, sizeof(str_t) + len);
+	assert(str != NULL);
+
+	memcpy(str->buf, text, len);
+	str->size = len;
+	str->cap  = len;
+	str->lit  = true;
+
+	str->hash     = hash_bytes(text, len);
+	str->hash_len = len;
+	return str;
+}
+
+str_t *str_new(arena_t *arena, size_t cap) {
+	str_t *str = (str_t*)arena_alloc(arena, sizeof(str_t) + cap);
+
+	str->size = 0;
+	str->cap  = cap;
+	str->lit  = false;
+
+	str->hash_len = SIZE_MAX;
+	return str;
+}
+
+str_t *str_append(arena_t *arena, str_t *str, size_t len, const char *text, size_t text_len) {
+	assert(len <= str->size);
+
+	/* Nobody else views past len, so the buffer can be grown. Growing by doubling keeps repeated
+	   appends linear */
+	size_t new_len = len + text_len;
+	if (!str->lit && len == str->size) {
+		if (new_len > str->cap) {
+			size_t cap = str->cap * 2 > new_len? str->cap * 2 : new_len;
+			if (arena_extend(arena, str, sizeof(str_t) + str->cap, sizeof(str_t) + cap))
+				str->cap = cap;
+		}
+
+		if (new_len <= str->cap) {
+			memcpy(str->buf + len, text, text_len);
+			str->size = new_len;
+			return str;
+		}
+	}
+
+	size_t cap = new_len * 2 > STR_MIN_CAP? new_len * 2 : STR_MIN_CAP;
+	str_t *new = str_new(arena, cap);
+	memcpy(new->buf, str->buf, len);
+	memcpy(new->buf + len, text, text_len);
+	new->size = new_len;
+	return new;
+}
+
+uint64_t str_hash(str_t *str, size_t len) {
+	assert(len <= str->size);
+	if (str->hash_len == len)
+		return str->hash;
+
+	uint64_t hash = hash_bytes(str->buf, len);
+	if (!str->lit) {
+		str->hash     = hash;
+		str->hash_len = len;
+	}
+
+	return hash;
+}
@@ -0,0 +1,38 @@
+#ifndef STR_H_HEADER_GUARD
+#define STR_H_HEADER_GUARD
+
+#include <stdint.h>  /* uint64_t, SIZE_MAX */
+#include <stdlib.h>  /* size_t */
+#include <string.h>  /* memcpy */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "arena.h"
+#include "alloc.h"
+#include "utils.h"
+
+/* Length-prefixed string buffer. String values view the first bytes of a buffer, so a buffer can
+   be appended to in place by whoever views all of it without changing what other values see.
+   Literals are allocated on the heap and owned by the program, everything else lives in an
+   arena. The hash of the first hash_len bytes is kept, since appending never changes them */
+typedef struct {
+	size_t size, cap;
+	bool   lit;
+
+	uint64_t hash;
+	size_t   hash_len; /* SIZE_MAX if nothing was hashed yet */
+
+	char buf[];
+} str_t;
+
+str_t *str_new_lit(const char *text, size_t len);
+str_t *str_new    (arena_t *arena, size_t cap);
+
+/* Returns a buffer that holds the first len bytes of str followed by text, appending in place
+   when possible */
+str_t *str_append(arena_t *arena, str_t *str, size_t len, const char *text, size_t text_len);
+
+/* Literals can be shared between threads, so only their whole length is hashed up front */
+uint64_t str_hash(str_t *str, size_t len);
+
+#endif
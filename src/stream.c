@@ -0,0 +1,216 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <pthread.h> /* pthread_t, pthread_create, pthread_join, pthread_detach */
+#include <unistd.h>  /* read */
+#include <errno.h>   /* errno, EINTR */
+
+#include "stream.h"
+
+typedef struct segment segment_t;
+struct segment {
+	program_t       prog;
+	parser_result_t result;
+	bool            last;
+
+	segment_t *next; /* In the list of finished segments that tasks still run */
+};
+
+typedef struct {
+	int         fd;
+	const char *path;
+
+	spsc_t queue;
+	bool   stop;
+	size_t refs;
+} stream_t;
+
+/* Both threads hold a reference, whoever lets go last frees the stream and what is still queued,
+   since the parser may be left blocked on reading input after the program exits */
+static void stream_release(stream_t *s) {
+	if (__atomic_sub_fetch(&s->refs, 1, __ATOMIC_ACQ_REL) > 0)
+		return;
+
+	void *item;
+	while (spsc_try_pop(&s->queue, &item)) {
+		segment_t *seg = (segment_t*)item;
+		if (seg->prog.ems != NULL)
+			program_destroy(&seg->prog);
+
+		free(seg);
+	}
+
+	spsc_destroy(&s->queue);
+	free(s);
+}
+
+static bool stream_send(stream_t *s, program_t prog, parser_result_t result, bool last) {
+	segment_t *seg = (segment_t*)malloc(sizeof(segment_t));
+	assert(seg != NULL);
+
+	*seg = (segment_t){.prog = prog, .result = result, .last = last};
+	if (!spsc_push(&s->queue, seg, &s->stop)) {
+		if (prog.ems != NULL)
+			program_destroy(&prog);
+
+		free(seg);
+		return false;
+	}
+
+	return true;
+}
+
+static void *stream_parser(void *arg) {
+	stream_t *s = (stream_t*)arg;
+	parser_t *p = parser_new(DEFAULT_PROGRAM_CAP);
+	p->path     = s->path;
+
+	size_t cap = STREAM_CHUNK_SIZE, size = 0;
+	char  *buf = (char*)malloc(cap + 1);
+	assert(buf != NULL);
+
+	bool eof = false;
+	while (!eof) {
+		if (size == cap) {
+			cap *= 2;
+			buf  = (char*)realloc(buf, cap + 1);
+			assert(buf != NULL);
+		}
+
+		ssize_t got;
+		do
+			got = read(s->fd, buf + size, cap - size);
+		while (got == -1 && errno == EINTR);
+
+		if (got <= 0)
+			eof = true;
+		else
+			size += (size_t)got;
+
+		/* No token crosses a newline, so everything up to the last one can be parsed now */
+		size_t cut = size;
+		if (!eof) {
+			while (cut > 0 && buf[cut - 1] != '\n')
+				-- cut;
+
+			if (cut == 0)
+				continue;
+		}
+
+		char save = buf[cut];
+		buf[cut]  = '\0';
+
+		program_t       seg;
+		parser_load_mem(p, buf);
+		parser_result_t result = parser_parse_segment(p, &seg, eof);
+
+		buf[cut] = save;
+		memmove(buf, buf + cut, size - cut);
+		size -= cut;
+
+		if (result.err != PARSER_OK) {
+			stream_send(s, (program_t){0}, result, true);
+			break;
+		} else if (seg.size > 0 || eof) {
+			if (!stream_send(s, seg, result, eof))
+				break;
+		}
+	}
+
+	/* Only the subroutine definitions are left */
+	free(buf);
+	program_destroy(&p->prog);
+	parser_destroy(p);
+	stream_release(s);
+	return NULL;
+}
+
+int stream_run(int fd, const char *path, env_limits_t limits) {
+	stream_t *s = (stream_t*)malloc(sizeof(stream_t));
+	assert(s != NULL);
+
+	*s = (stream_t){.fd = fd, .path = path, .refs = 2};
+	spsc_init(&s->queue, STREAM_QUEUE_CAP);
+
+	pthread_t thread;
+	if (pthread_create(&thread, NULL, stream_parser, s) != 0) {
+		fprintf(stderr, "Error: Failed to start the parser thread\n");
+		return EXIT_FAILURE;
+	}
+	pthread_detach(thread);
+
+	env_t *e = env_new(DEFAULT_STACK_CAP);
+	e->no_stdin = true;
+	e->limits   = limits;
+	env_load(e, NULL);
+
+	int        ex   = 0;
+	bool       last = false;
+	segment_t *kept = NULL;
+	while (!last && !e->halt) {
+		/* Popped through a void pointer, writing to seg as one would break strict aliasing */
+		void *item;
+		spsc_pop(&s->queue, &item, NULL);
+		segment_t *seg = (segment_t*)item;
+
+		last = seg->last;
+		if (seg->result.err != PARSER_OK) {
+			fprintf(stderr, "Error at %s:%zu:%zu: %s\n", seg->result.path, seg->result.row,
+			        seg->result.col, parser_err_to_cstr(seg->result.err));
+			ex = EXIT_FAILURE;
+		} else if (seg->prog.size > 0) {
+			e->prog = &seg->prog;
+			e->ip   = 0;
+
+			runtime_result_t result = env_exec(e);
+			if (result.err != RUNTIME_OK) {
+				/* A task might have failed in an older segment, but they all share the source */
+				location_t loc = program_locate(&seg->prog, result.em);
+				fprintf(stderr, "Error at %s:%zu:%zu: %s\n",
+				        loc.path, loc.row, loc.col, runtime_err_to_cstr(result.err));
+				ex   = EXIT_FAILURE;
+				last = true;
+			} else
+				ex = e->ex;
+
+			env_own_literals(e);
+		}
+
+		/* Blocked tasks can outlive the segment they were started in */
+		for (segment_t **it = &kept; *it != NULL;) {
+			segment_t *old = *it;
+			if (env_tasks_use(e, &old->prog)) {
+				it = &old->next;
+				continue;
+			}
+
+			*it = old->next;
+			program_destroy(&old->prog);
+			free(old);
+		}
+
+		if (seg->prog.ems != NULL && env_tasks_use(e, &seg->prog)) {
+			seg->next = kept;
+			kept      = seg;
+		} else {
+			if (seg->prog.ems != NULL)
+				program_destroy(&seg->prog);
+
+			free(seg);
+		}
+	}
+
+	__atomic_store_n(&s->stop, true, __ATOMIC_RELEASE);
+	stream_release(s);
+
+	env_unload(e);
+	env_destroy(e);
+
+	while (kept != NULL) {
+		segment_t *next = kept->next;
+		program_destroy(&kept->prog);
+		free(kept);
+		kept = next;
+	}
+
+	return ex;
+}
@@ -0,0 +1,22 @@
+#ifndef STREAM_H_HEADER_GUARD
+#define STREAM_H_HEADER_GUARD
+
+#include <stdio.h>   /* fprintf */
+#include <stdlib.h>  /* malloc, realloc, free, EXIT_FAILURE */
+#include <string.h>  /* memchr, memmove */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "parser.h"
+#include "env.h"
+#include "spsc.h"
+
+#define STREAM_CHUNK_SIZE (64 * 1024)
+#define STREAM_QUEUE_CAP  16
+
+/* Reads a program from fd on a parser thread and runs every segment of it as soon as all of its
+   blocks are closed, so the program runs while it is still being read. The limits hold for the
+   whole program. Returns the exit code */
+int stream_run(int fd, const char *path, env_limits_t limits);
+
+#endif
@@ -0,0 +1,54 @@
+#include "task.h"
+
+void task_queue_push(task_t *tasks, task_queue_t *q, size_t id) {
+	tasks[id].next = TASK_NONE;
+	if (q->head == TASK_NONE)
+		q->head = id;
+	else
+		tasks[q->tail].next = id;
+
+	q->tail = id;
+}
+
+size_t task_queue_pop(task_t *tasks, task_queue_t *q) {
+	size_t id = q->head;
+	if (id != TASK_NONE)
+		q->head = tasks[id].next;
+
+	return id;
+}
+
+chan_t *chan_new(arena_t *arena, size_t cap) {
+	chan_t *chan = (chan_t*)arena_alloc(arena, sizeof(chan_t));
+	chan->buf  = cap > 0? (data_t*)arena_alloc(arena, cap * sizeof(data_t)) : NULL;
+	chan->cap  = cap;
+	chan->head = 0;
+	chan->size = 0;
+
+	chan->senders   = TASK_QUEUE_EMPTY;
+	chan->receivers = TASK_QUEUE_EMPTY;
+	chan->epoch     = 0;
+	return chan;
+}
+
+chan_t *chan_copy(arena_t *arena, chan_t *chan) {
+	return chan_new(arena, chan->cap);
+}
+
+bool chan_push(chan_t *chan, data_t val) {
+	if (chan->size >= chan->cap)
+		return false;
+
+	chan->buf[(chan->head + chan->size ++) % chan->cap] = val;
+	return true;
+}
+
+bool chan_pop(chan_t *chan, data_t *val) {
+	if (chan->size == 0)
+		return false;
+
+	*val       = chan->buf[chan->head];
+	chan->head = (chan->head + 1) % chan->cap;
+	-- chan->size;
+	return true;
+}
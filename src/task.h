@@ -0,0 +1,81 @@
+#ifndef TASK_H_HEADER_GUARD
+#define TASK_H_HEADER_GUARD
+
+#include <stdint.h>  /* SIZE_MAX */
+#include <stdlib.h>  /* size_t */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+
+#include "em.h"
+#include "stack.h"
+#include "arena.h"
+#include "data.h"
+
+#define TASK_NONE SIZE_MAX
+
+/* How many values the stack of a new task has room for, it grows like any other stack */
+#ifndef TASK_STACK_CAP
+#	define TASK_STACK_CAP 16
+#endif
+
+/* Subroutines can print while called from a print block, which is restored when they return */
+typedef struct {
+	size_t ret;
+
+	bool   print;
+	size_t print_from;
+} call_t;
+
+typedef enum {
+	TASK_FREE = 0, /* Finished, the buffers are kept for the next task */
+	TASK_RUNNING,
+	TASK_READY,
+	TASK_BLOCKED,
+} task_state_t;
+
+/* Everything a green task needs to continue where it left off. While a task runs, this lives in
+   the env instead and the task only holds a stale copy */
+typedef struct {
+	program_t *prog;
+	size_t     ip; /* The last instruction it ran */
+	stack_t    stack;
+
+	call_t *calls;
+	size_t  calls_size, calls_cap;
+
+	bool   print;
+	size_t print_from;
+
+	task_state_t state;
+	size_t       next; /* Next task in the queue it is in */
+	data_t       val;  /* What a blocked sender sends */
+} task_t;
+
+/* Queues of task indices, linked through the tasks themselves. A task is in at most one queue */
+typedef struct {
+	size_t head, tail;
+} task_queue_t;
+
+#define TASK_QUEUE_EMPTY ((task_queue_t){.head = TASK_NONE, .tail = TASK_NONE})
+
+void   task_queue_push(task_t *tasks, task_queue_t *q, size_t id);
+size_t task_queue_pop (task_t *tasks, task_queue_t *q); /* TASK_NONE if empty */
+
+/* A ring of cap values with queues of the tasks blocked on sending or receiving. A channel with no
+   room hands values over from a sender to a receiver directly. Channels live in an arena and keep
+   the epoch of the tasks they queued, the queues are stale once the tasks were reset */
+struct chan {
+	data_t *buf;
+	size_t  cap, head, size;
+
+	task_queue_t senders, receivers;
+	size_t       epoch;
+};
+
+chan_t *chan_new (arena_t *arena, size_t cap);
+chan_t *chan_copy(arena_t *arena, chan_t *chan); /* Only the capacity, the copy is empty */
+
+bool chan_push(chan_t *chan, data_t  val); /* false if full */
+bool chan_pop (chan_t *chan, data_t *val); /* false if empty */
+
+#endif
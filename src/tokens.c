@@ -0,0 +1,62 @@
+#include "tokens.h"
+
+void tokens_init(tokens_t *t) {
+	ZERO_STRUCT(t);
+}
+
+void tokens_destroy(tokens_t *t) {
+	for (size_t i = 0; i < t->count; ++ i)
+		free(t->lines[i].toks);
+
+	free(t->lines);
+}
+
+static void tokens_lex_line(token_line_t *line, const char *text, size_t len) {
+	size_t  pos = 0, cap = 0;
+	token_t tok;
+	while (parser_next_token(text, len, &pos, &tok)) {
+		if (line->count >= cap) {
+			cap        = cap == 0? 8 : cap * 2;
+			line->toks = (token_t*)realloc(line->toks, cap * sizeof(token_t));
+			assert(line->toks != NULL);
+		}
+
+		line->toks[line->count ++] = tok;
+	}
+}
+
+void tokens_edit(tokens_t *t, size_t first, size_t removed, const char *text, size_t len) {
+	assert(first + removed <= t->count);
+
+	size_t added = 1;
+	for (size_t i = 0; i < len; ++ i)
+		added += text[i] == '\n';
+
+	for (size_t i = first; i < first + removed; ++ i)
+		free(t->lines[i].toks);
+
+	size_t count = t->count - removed + added;
+	if (count > t->cap) {
+		t->cap = t->cap == 0? 64 : t->cap;
+		while (t->cap < count)
+			t->cap *= 2;
+
+		t->lines = (token_line_t*)realloc(t->lines, t->cap * sizeof(token_line_t));
+		assert(t->lines != NULL);
+	}
+
+	memmove(t->lines + first + added, t->lines + first + removed,
+	        (t->count - first - removed) * sizeof(token_line_t));
+	t->count = count;
+
+	/* Only the new lines are lexed */
+	const char *line = text;
+	for (size_t i = first; i < first + added; ++ i) {
+		const char *end = (const char*)memchr(line, '\n', len - (size_t)(line - text));
+		size_t      size = end == NULL? len - (size_t)(line - text) : (size_t)(end - line);
+
+		t->lines[i] = (token_line_t){0};
+		tokens_lex_line(&t->lines[i], line, size);
+		line += size + 1;
+	}
+}
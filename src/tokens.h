@@ -0,0 +1,32 @@
+#ifndef TOKENS_H_HEADER_GUARD
+#define TOKENS_H_HEADER_GUARD
+
+#include <stdlib.h>  /* size_t, malloc, realloc, free */
+#include <string.h>  /* memmove, memchr */
+#include <assert.h>  /* assert */
+
+#include "parser.h"
+
+/* Tokens of one line, their offsets are from the start of the line */
+typedef struct {
+	token_t *toks;
+	size_t   count;
+} token_line_t;
+
+/* The tokens of a text kept line by line, for editors and other tools that lex the same text over
+   and over. Tokens never cross newlines, so an edit only lexes the lines it replaced again, and
+   the offsets of the other lines stay as they were */
+typedef struct {
+	token_line_t *lines;
+	size_t        count, cap;
+} tokens_t;
+
+void tokens_init   (tokens_t *t);
+void tokens_destroy(tokens_t *t);
+
+/* Replaces the lines from first up to first + removed with the len bytes of text, which are split
+   at newlines, so text always makes one line more than it has newlines. The whole text is set by
+   replacing all of the lines */
+void tokens_edit(tokens_t *t, size_t first, size_t removed, const char *text, size_t len);
+
+#endif
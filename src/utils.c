@@ -1,10 +1,39 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <time.h>     /* clock_gettime, CLOCK_MONOTONIC */
+#include <signal.h>   /* signal, SIGPIPE, SIG_IGN */
+#include <errno.h>    /* errno, EINTR */
+#include <sys/wait.h> /* waitpid, WNOHANG, WIFEXITED, WEXITSTATUS */
+
 #include "utils.h"
 
-char *strcpy_to_heap(const char *str) {
-	char *ptr = (char*)malloc(strlen(str) + 1);
-	if (ptr == NULL)
-		return NULL;
+double time_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+void ignore_sigpipe(void) {
+	signal(SIGPIPE, SIG_IGN);
+}
+
+int reap_child(pid_t pid, bool block) {
+	int   status;
+	pid_t ret;
+	while ((ret = waitpid(pid, &status, block? 0 : WNOHANG)) < 0 && errno == EINTR);
+
+	if (ret == 0)
+		return 1;
+
+	return ret == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0? 0 : -1;
+}
+
+uint64_t hash_bytes(const char *buf, size_t size) {
+	uint64_t hash = 14695981039346656037ULL;
+	for (size_t i = 0; i < size; ++ i) {
+		hash ^= (unsigned char)buf[i];
+		hash *= 1099511628211ULL;
+	}
 
-	strcpy(ptr, str);
-	return ptr;
+	return hash;
 }
@@ -1,11 +1,24 @@
 #ifndef UTILS_H_HEADER_GUARD
 #define UTILS_H_HEADER_GUARD
 
-#include <string.h> /* strcpy, strlen, memset */
-#include <stdlib.h> /* malloc */
+#include <string.h>    /* memset, size_t */
+#include <stdint.h>    /* uint64_t */
+#include <stdbool.h>   /* bool, true, false */
+#include <sys/types.h> /* pid_t */
 
 #define ZERO_STRUCT(STRUCT) memset(STRUCT, 0, sizeof(*(STRUCT)))
 
-char *strcpy_to_heap(const char *str);
+/* Seconds on a monotonic clock, only meaningful as a difference of two calls */
+double time_now(void);
+
+/* Lives here since signal.h defines a stack_t of its own */
+void ignore_sigpipe(void);
+
+/* Same reason as above for sys/wait.h. Returns 1 while the child is still running (only if not
+   blocking), 0 if it exited with 0 and -1 if it failed */
+int reap_child(pid_t pid, bool block);
+
+/* 64-bit FNV-1a */
+uint64_t hash_bytes(const char *buf, size_t size);
 
 #endif
@@ -0,0 +1,233 @@
+#define _GNU_SOURCE
+
+#include <errno.h>   /* errno, EINTR */
+#include <unistd.h>  /* ssize_t */
+#include <sys/uio.h> /* writev, struct iovec */
+
+#include "writer.h"
+
+typedef struct {
+	uint32_t stream, size;
+} record_t;
+
+/* Records are capped so that one always fits in the ring with room to spare */
+#define WRITER_RECORD_MAX (WRITER_RING_CAP / 4)
+
+static void writer_put(writer_t *w, size_t at, const void *buf, size_t size) {
+	size_t i = at & (w->cap - 1), first = w->cap - i < size? w->cap - i : size;
+	memcpy(w->ring + i, buf, first);
+	memcpy(w->ring, (const char*)buf + first, size - first);
+}
+
+static void writer_get(writer_t *w, size_t at, void *buf, size_t size) {
+	size_t i = at & (w->cap - 1), first = w->cap - i < size? w->cap - i : size;
+	memcpy(buf, w->ring + i, first);
+	memcpy((char*)buf + first, w->ring, size - first);
+}
+
+/* Sleeps until the thread moved the head up to at least head. The thread only wakes anyone once
+   it sees waiting, and both sides store before they load what the other one stored, so either the
+   thread sees the waiter or the waiter sees the new head */
+static void writer_wait_head(writer_t *w, size_t head) {
+	pthread_mutex_lock(&w->wait_lock);
+	__atomic_add_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&w->head, __ATOMIC_SEQ_CST) < head)
+		pthread_cond_wait(&w->written, &w->wait_lock);
+
+	__atomic_sub_fetch(&w->waiting, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&w->wait_lock);
+}
+
+/* Sleeps while the ring is full */
+static ssize_t writer_cookie_write(void *cookie, const char *buf, size_t size) {
+	writer_cookie_t *c = (writer_cookie_t*)cookie;
+	writer_t        *w = c->w;
+
+	pthread_mutex_lock(&w->lock);
+	for (size_t left = size; left > 0;) {
+		record_t record = {
+			.stream = c->stream,
+			.size   = (uint32_t)(left < WRITER_RECORD_MAX? left : WRITER_RECORD_MAX),
+		};
+
+		size_t need = sizeof(record) + record.size, tail = w->tail;
+		if (w->cap - (tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE)) < need)
+			writer_wait_head(w, tail + need - w->cap);
+
+		writer_put(w, tail, &record, sizeof(record));
+		writer_put(w, tail + sizeof(record), buf, record.size);
+		__atomic_store_n(&w->tail, tail + need, __ATOMIC_SEQ_CST);
+
+		/* Same as in writer_wait_head, either the thread sees this record before it sleeps or
+		   this sees it sleeping */
+		if (__atomic_load_n(&w->sleeping, __ATOMIC_SEQ_CST)) {
+			pthread_mutex_lock(&w->wait_lock);
+			pthread_cond_signal(&w->ready);
+			pthread_mutex_unlock(&w->wait_lock);
+		}
+
+		buf  += record.size;
+		left -= record.size;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return (ssize_t)size;
+}
+
+/* Output that can not be written is dropped, a reader that went away should not block the
+   program */
+static void writer_writev(int fd, struct iovec *iov, int count) {
+	while (count > 0) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		for (; count > 0 && (size_t)written >= iov->iov_len; ++ iov, -- count)
+			written -= (ssize_t)iov->iov_len;
+
+		if (count > 0) {
+			iov->iov_base  = (char*)iov->iov_base + written;
+			iov->iov_len  -= (size_t)written;
+		}
+	}
+}
+
+static void *writer_thread(void *arg) {
+	writer_t *w = (writer_t*)arg;
+
+	size_t tries = 0;
+	while (true) {
+		size_t head = w->head, tail = __atomic_load_n(&w->tail, __ATOMIC_SEQ_CST);
+		if (head == tail) {
+			/* Programs print line by line, so the next record is usually close. Only a ring that
+			   stays empty puts the thread to sleep */
+			if (tries < WRITER_SPINS) {
+				spsc_backoff(&tries);
+				continue;
+			}
+
+			pthread_mutex_lock(&w->wait_lock);
+			__atomic_store_n(&w->sleeping, true, __ATOMIC_SEQ_CST);
+			while (!w->stop && __atomic_load_n(&w->tail, __ATOMIC_SEQ_CST) == head)
+				pthread_cond_wait(&w->ready, &w->wait_lock);
+
+			__atomic_store_n(&w->sleeping, false, __ATOMIC_SEQ_CST);
+			bool done = w->stop && __atomic_load_n(&w->tail, __ATOMIC_SEQ_CST) == head;
+			pthread_mutex_unlock(&w->wait_lock);
+			if (done)
+				break;
+
+			tries = 0;
+			continue;
+		}
+
+		/* A record that wraps around the end of the ring takes two iovecs */
+		struct iovec iov[WRITER_IOV_MAX];
+		int          count  = 0;
+		uint32_t     stream = 0;
+		while (head < tail && count + 2 <= WRITER_IOV_MAX) {
+			record_t record;
+			writer_get(w, head, &record, sizeof(record));
+			if (count > 0 && record.stream != stream)
+				break;
+
+			stream = record.stream;
+
+			size_t at = (head + sizeof(record)) & (w->cap - 1), size = record.size;
+			size_t first = w->cap - at < size? w->cap - at : size;
+			iov[count ++] = (struct iovec){.iov_base = w->ring + at, .iov_len = first};
+			if (size > first)
+				iov[count ++] = (struct iovec){.iov_base = w->ring, .iov_len = size - first};
+
+			head += sizeof(record) + size;
+		}
+
+		writer_writev(w->fds[stream], iov, count);
+		__atomic_store_n(&w->head, head, __ATOMIC_SEQ_CST);
+		tries = 0;
+
+		if (__atomic_load_n(&w->waiting, __ATOMIC_SEQ_CST) > 0) {
+			pthread_mutex_lock(&w->wait_lock);
+			pthread_cond_broadcast(&w->written);
+			pthread_mutex_unlock(&w->wait_lock);
+		}
+	}
+
+	return NULL;
+}
+
+static FILE *writer_file(writer_t *w, writer_stream_t stream) {
+	w->cookies[stream] = (writer_cookie_t){.w = w, .stream = stream};
+
+	cookie_io_functions_t io = {.write = writer_cookie_write};
+	FILE *file = fopencookie(&w->cookies[stream], "w", io);
+	assert(file != NULL);
+
+	setvbuf(file, NULL, _IOFBF, BUFSIZ);
+	return file;
+}
+
+writer_t *writer_new(int out_fd, int err_fd) {
+	assert((WRITER_RING_CAP & (WRITER_RING_CAP - 1)) == 0);
+
+	writer_t *w = (writer_t*)malloc(sizeof(writer_t));
+	assert(w != NULL);
+
+	*w = (writer_t){.cap = WRITER_RING_CAP};
+	w->ring = (char*)malloc(w->cap);
+	assert(w->ring != NULL);
+
+	w->fds[WRITER_OUT] = out_fd;
+	w->fds[WRITER_ERR] = err_fd;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_mutex_init(&w->wait_lock, NULL);
+	pthread_cond_init(&w->ready, NULL);
+	pthread_cond_init(&w->written, NULL);
+
+	if (pthread_create(&w->thread, NULL, writer_thread, w) != 0) {
+		pthread_cond_destroy(&w->written);
+		pthread_cond_destroy(&w->ready);
+		pthread_mutex_destroy(&w->wait_lock);
+		pthread_mutex_destroy(&w->lock);
+		free(w->ring);
+		free(w);
+		return NULL;
+	}
+
+	w->out = writer_file(w, WRITER_OUT);
+	w->err = writer_file(w, WRITER_ERR);
+	return w;
+}
+
+/* The thread might already be past what was in the ring when this was called */
+static void writer_wait(writer_t *w) {
+	pthread_mutex_lock(&w->lock);
+	size_t tail = w->tail;
+	pthread_mutex_unlock(&w->lock);
+
+	writer_wait_head(w, tail);
+}
+
+/* Closing the files flushes them into the ring */
+void writer_destroy(writer_t *w) {
+	fclose(w->out);
+	fclose(w->err);
+	writer_wait(w);
+
+	pthread_mutex_lock(&w->wait_lock);
+	w->stop = true;
+	pthread_cond_signal(&w->ready);
+	pthread_mutex_unlock(&w->wait_lock);
+	pthread_join(w->thread, NULL);
+
+	pthread_cond_destroy(&w->written);
+	pthread_cond_destroy(&w->ready);
+	pthread_mutex_destroy(&w->wait_lock);
+	pthread_mutex_destroy(&w->lock);
+	free(w->ring);
+	free(w);
+}
@@ -0,0 +1,85 @@
+#ifndef WRITER_H_HEADER_GUARD
+#define WRITER_H_HEADER_GUARD
+
+#include <stdio.h>   /* FILE, fflush, fclose, setvbuf */
+#include <stdint.h>  /* uint32_t */
+#include <stdlib.h>  /* malloc, free, size_t */
+#include <string.h>  /* memcpy */
+#include <assert.h>  /* assert */
+#include <stdbool.h> /* bool, true, false */
+#include <pthread.h> /* pthread_t, pthread_mutex_t, pthread_cond_t */
+
+#include "spsc.h"
+
+/* Bytes of output that can wait to be written before printing blocks */
+#ifndef WRITER_RING_CAP
+#	define WRITER_RING_CAP (1024 * 1024)
+#endif
+
+/* Most records one writev takes */
+#ifndef WRITER_IOV_MAX
+#	define WRITER_IOV_MAX 64
+#endif
+
+/* Times the thread spins and yields on an empty ring before it sleeps, spsc_backoff only starts
+   sleeping after these */
+#ifndef WRITER_SPINS
+#	define WRITER_SPINS 128
+#endif
+
+typedef enum {
+	WRITER_OUT = 0,
+	WRITER_ERR,
+
+	WRITER_STREAMS_COUNT,
+} writer_stream_t;
+
+typedef struct writer writer_t;
+
+typedef struct {
+	writer_t       *w;
+	writer_stream_t stream;
+} writer_cookie_t;
+
+/* Output that a thread of its own writes, so a slow reader of stdout or stderr does not stall the
+   interpreter until the ring is full. out and err are buffered files that put every flush into
+   the ring as one record, tagged with its stream. Records of both streams share the ring, so they
+   are written in the order they were flushed, and the thread writes the records of one stream
+   that come in a row with a single writev. Spawn workers print too, so putting a record in takes
+   a lock that the writing thread never does. The thread sleeps once the ring stayed empty for a
+   moment, and printing into a full ring sleeps until the thread wrote some of it */
+struct writer {
+	char  *ring;
+	size_t cap;
+
+	char   pad0[SPSC_CACHE_LINE];
+	size_t head; /* Written only by the thread, once the bytes before it were written */
+	char   pad1[SPSC_CACHE_LINE];
+	size_t tail; /* Written only under lock */
+	char   pad2[SPSC_CACHE_LINE];
+
+	pthread_mutex_t lock;
+	pthread_t       thread;
+
+	/* ready wakes the sleeping thread once a record was put in or stop was set, written wakes
+	   the waiting producers once head moved */
+	pthread_mutex_t wait_lock;
+	pthread_cond_t  ready, written;
+	bool            sleeping;
+	size_t          waiting;
+	bool            stop; /* Under wait_lock */
+
+	int             fds    [WRITER_STREAMS_COUNT];
+	writer_cookie_t cookies[WRITER_STREAMS_COUNT];
+
+	FILE *out, *err;
+};
+
+/* NULL if the thread could not be started */
+writer_t *writer_new(int out_fd, int err_fd);
+
+/* Closes out and err and returns once everything in the ring was written, or dropped if writing
+   to its fd failed */
+void writer_destroy(writer_t *w);
+
+#endif